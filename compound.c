@@ -0,0 +1,336 @@
+#include "compound.h"
+
+#include <linux/completion.h>
+#include <linux/ctype.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "http.h"
+#include "models.h"
+
+// Request buffers kept in reserve for each mount
+#define COMPOUND_MIN_REQUESTS 2
+
+struct networkfs_compound_op {
+  struct list_head list;
+  struct networkfs_call *call;
+  bool leader;  // makes requests until its own call is sent
+  bool taken;   // moved to a request
+};
+
+// Element of the per-mount request pool. Requests of several calls never
+// exceed NETWORKFS_COMPOUND_MAX_SIZE, see networkfs_compound_take().
+struct networkfs_compound_request {
+  char ops[NETWORKFS_COMPOUND_MAX_SIZE + 1];
+  struct compound_results results;
+};
+
+struct kmem_cache *networkfs_compound_cachep;
+
+int networkfs_compound_cache_init(void) {
+  networkfs_compound_cachep = KMEM_CACHE(networkfs_compound_request, 0);
+  return networkfs_compound_cachep == NULL ? -ENOMEM : 0;
+}
+
+void networkfs_compound_cache_exit(void) {
+  kmem_cache_destroy(networkfs_compound_cachep);
+}
+
+int networkfs_compound_init(struct networkfs_compound *compound,
+                            struct networkfs_transport *transport) {
+  compound->transport = transport;
+  spin_lock_init(&compound->lock);
+  INIT_LIST_HEAD(&compound->queue);
+  compound->waiting = 0;
+  compound->leaders = 0;
+  compound->unsupported = false;
+  compound->requests = mempool_create_slab_pool(COMPOUND_MIN_REQUESTS,
+                                                networkfs_compound_cachep);
+  return compound->requests == NULL ? -ENOMEM : 0;
+}
+
+void networkfs_compound_destroy(struct networkfs_compound *compound) {
+  mempool_destroy(compound->requests);
+}
+
+bool networkfs_compound_unreserved(char c) {
+  return isascii(c) && (isalnum(c) || c == '-' || c == '.' || c == '_');
+}
+
+// Appends encoded @field at @position, returns the position past it
+char *networkfs_compound_escape(char *position, const char *field) {
+  for (; *field != '\0'; field++) {
+    if (networkfs_compound_unreserved(*field)) {
+      *position++ = *field;
+    } else {
+      *position++ = '~';
+      position = hex_byte_pack_upper(position, *field);
+    }
+  }
+  return position;
+}
+
+// Upper bound of the encoded length of @call, separator included. Escaped
+// fields are left alone by URL encoding, but separators are not, so each
+// counts as its percent-encoded form and the query stays within the limit.
+size_t networkfs_compound_op_size(const struct networkfs_call *call) {
+  size_t size = strlen(call->method) + 3;
+  for (int i = 0; i < 2 * call->arg_size; i++) {
+    size += 3 * strlen(call->args[i]) + 3;
+  }
+  return size;
+}
+
+// Moves the oldest queued calls that fit into one request to @batch. Calls
+// of other leaders are left for them. Returns the number of calls, at least
+// one. Called with the lock held.
+size_t networkfs_compound_take(struct networkfs_compound *compound,
+                               struct networkfs_compound_op *self,
+                               struct list_head *batch) {
+  struct networkfs_compound_op *op, *tmp;
+  size_t count = 0;
+  size_t size = 0;
+
+  list_for_each_entry_safe(op, tmp, &compound->queue, list) {
+    if (op->leader && op != self) {
+      continue;
+    }
+    size += networkfs_compound_op_size(op->call);
+    if (count == NETWORKFS_COMPOUND_MAX_OPS ||
+        (count > 0 && size > NETWORKFS_COMPOUND_MAX_SIZE)) {
+      break;
+    }
+    if (op != self) {
+      --compound->waiting;
+    }
+    op->taken = true;
+    list_move_tail(&op->list, batch);
+    ++count;
+  }
+  return count;
+}
+
+// Encodes operations of @batch into @ops, which has room for all of them
+void networkfs_compound_encode(char *ops, struct list_head *batch) {
+  struct networkfs_compound_op *op;
+  char *position = ops;
+
+  list_for_each_entry(op, batch, list) {
+    if (position != ops) {
+      *position++ = ';';
+    }
+    position = networkfs_compound_escape(position, op->call->method);
+    for (int i = 0; i < 2 * op->call->arg_size; i++) {
+      *position++ = ',';
+      position = networkfs_compound_escape(position, op->call->args[i]);
+    }
+  }
+  *position = '\0';
+}
+
+// Makes the calls of @batch one by one
+void networkfs_compound_run_each(struct networkfs_compound *compound,
+                                 struct list_head *batch) {
+  struct networkfs_compound_op *op, *tmp;
+
+  list_for_each_entry_safe(op, tmp, batch, list) {
+    list_del(&op->list);
+    networkfs_call_complete(
+        op->call, networkfs_call_run(compound->transport, op->call));
+  }
+}
+
+// Reports @results to the calls of @batch. A call may return as soon as it
+// is completed, so its op is not touched afterwards.
+void networkfs_compound_complete(struct list_head *batch,
+                                 const struct compound_results *results) {
+  struct networkfs_compound_op *op, *tmp;
+  size_t i = 0;
+
+  list_for_each_entry_safe(op, tmp, batch, list) {
+    struct networkfs_call *call = op->call;
+    list_del(&op->list);
+    if (i >= results->results_count) {
+      networkfs_call_complete(call, -EPROTMALFORMED);
+      continue;
+    }
+
+    const struct compound_result *result = &results->results[i++];
+    call->response_size = sizeof(result->response);
+    memcpy(call->response_buffer, &result->response,
+           min(call->buffer_size, sizeof(result->response)));
+    networkfs_call_complete(call, result->status);
+  }
+}
+
+// Makes one request for all calls of @batch and completes them
+void networkfs_compound_send(struct networkfs_compound *compound,
+                             struct list_head *batch, size_t count) {
+  struct networkfs_call call;
+  bool idempotent = true;
+  struct networkfs_compound_op *op;
+
+  if (count == 1 || READ_ONCE(compound->unsupported)) {
+    networkfs_compound_run_each(compound, batch);
+    return;
+  }
+
+  list_for_each_entry(op, batch, list) {
+    idempotent = idempotent && op->call->idempotent;
+  }
+  struct networkfs_compound_request *request =
+      mempool_alloc(compound->requests, GFP_KERNEL);
+  if (request == NULL) {
+    networkfs_compound_run_each(compound, batch);
+    return;
+  }
+  struct compound_results *results = &request->results;
+
+  networkfs_compound_encode(request->ops, batch);
+  networkfs_call_init(&call, "compound", (char *)results,
+                      sizeof(struct compound_results), 1, "ops", request->ops);
+  // Request may be sent again only if every operation may
+  call.idempotent = idempotent;
+  int64_t ret = networkfs_call_run(compound->transport, &call);
+  if (ret == -EHTTPBADCODE) {
+    WRITE_ONCE(compound->unsupported, true);
+    networkfs_compound_run_each(compound, batch);
+  } else if (ret != NETWORKFS_OK) {
+    struct networkfs_compound_op *tmp;
+    list_for_each_entry_safe(op, tmp, batch, list) {
+      list_del(&op->list);
+      networkfs_call_complete(op->call, ret);
+    }
+  } else {
+    networkfs_compound_complete(batch, results);
+  }
+
+  mempool_free(request, compound->requests);
+}
+
+// Queues the call and waits until it is answered. The caller that finds no
+// request in progress, or completes a full request, leads: it sends the
+// oldest waiting calls until its own one is sent. The last leader to finish
+// hands the turn to the oldest call queued meanwhile.
+int64_t networkfs_compound_run(struct networkfs_compound *compound,
+                               struct networkfs_call *call) {
+  struct networkfs_compound_op op = {.call = call};
+
+  if (READ_ONCE(compound->unsupported)) {
+    return networkfs_call_run(compound->transport, call);
+  }
+
+  spin_lock(&compound->lock);
+  list_add_tail(&op.list, &compound->queue);
+  if (compound->leaders > 0 &&
+      compound->waiting + 1 < NETWORKFS_COMPOUND_MAX_OPS) {
+    ++compound->waiting;
+    spin_unlock(&compound->lock);
+    wait_for_completion(&call->done);
+    if (!op.leader) {
+      return call->result;
+    }
+    // Calls of leaders are taken by no one else, so nothing completes it
+    // meanwhile
+    reinit_completion(&call->done);
+    spin_lock(&compound->lock);
+  } else {
+    op.leader = true;
+    ++compound->leaders;
+  }
+
+  while (!op.taken) {
+    LIST_HEAD(batch);
+    size_t count = networkfs_compound_take(compound, &op, &batch);
+    spin_unlock(&compound->lock);
+
+    networkfs_compound_send(compound, &batch, count);
+    spin_lock(&compound->lock);
+  }
+
+  --compound->leaders;
+  if (compound->leaders == 0 && compound->waiting > 0) {
+    struct networkfs_compound_op *next;
+    list_for_each_entry(next, &compound->queue, list) {
+      if (!next->leader) {
+        break;
+      }
+    }
+    next->leader = true;
+    --compound->waiting;
+    ++compound->leaders;
+    complete(&next->call->done);
+  }
+  spin_unlock(&compound->lock);
+
+  return networkfs_call_wait(call);
+}
+
+int64_t networkfs_compound_call(struct networkfs_compound *compound,
+                                const char *method, char *response_buffer,
+                                size_t buffer_size, size_t arg_size, ...) {
+  struct networkfs_call call;
+  va_list args;
+
+  va_start(args, arg_size);
+  int error = networkfs_call_vinit(&call, method, response_buffer,
+                                   buffer_size, arg_size, args);
+  va_end(args);
+  if (error != 0) {
+    return error;
+  }
+
+  return networkfs_compound_run(compound, &call);
+}
+
+// Decodes @field in place. Fails on malformed escapes and on escaped
+// terminators.
+bool networkfs_compound_unescape(char *field) {
+  char *position = field;
+
+  for (; *field != '\0'; field++) {
+    if (*field != '~') {
+      *position++ = *field;
+      continue;
+    }
+    int high = hex_to_bin(field[1]);
+    int low = high < 0 ? -1 : hex_to_bin(field[2]);
+    if (low < 0 || (high == 0 && low == 0)) {
+      return false;
+    }
+    *position++ = (high << 4) | low;
+    field += 2;
+  }
+  *position = '\0';
+  return true;
+}
+
+int networkfs_compound_parse(char **ops, struct networkfs_call *call) {
+  char *fields[1 + 2 * NETWORKFS_MAX_ARGS];
+  size_t count = 0;
+  char *field;
+
+  char *op = strsep(ops, ";");
+  if (op == NULL) {
+    return 0;
+  }
+
+  while ((field = strsep(&op, ",")) != NULL) {
+    if (count == ARRAY_SIZE(fields) || !networkfs_compound_unescape(field)) {
+      return -EINVAL;
+    }
+    fields[count++] = field;
+  }
+  // Method followed by key and value pairs
+  if (count % 2 == 0 || *fields[0] == '\0') {
+    return -EINVAL;
+  }
+
+  call->method = fields[0];
+  call->arg_size = count / 2;
+  for (int i = 1; i < count; i++) {
+    call->args[i - 1] = fields[i];
+  }
+  return 1;
+}
@@ -0,0 +1,93 @@
+#ifndef NETWORKFS_COMPOUND
+#define NETWORKFS_COMPOUND
+
+#include <linux/list.h>
+#include <linux/mempool.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "transport.h"
+
+// Operations carried by one compound request
+#define NETWORKFS_COMPOUND_MAX_OPS 16
+// Longest list of operations once URL-encoded, so the request line stays
+// short
+#define NETWORKFS_COMPOUND_MAX_SIZE 4096
+
+/**
+ * struct networkfs_compound - groups calls of a mount into compound requests.
+ * @transport:   Transport the requests are made over.
+ * @lock:        Protects @queue, @waiting and @leaders.
+ * @queue:       Calls not sent yet, oldest first.
+ * @waiting:     Calls in @queue that wait for a leader to send them.
+ * @leaders:     Callers making requests. While there are some, calls are
+ *               queued to go out together, so the window for grouping is the
+ *               round trip of a request and a lone call is never delayed.
+ *               Once a full request is queued, its last caller sends it
+ *               without waiting, so several requests may be in flight.
+ * @unsupported: Server has no compound method, calls are made one by one.
+ * @requests:    Buffers for the encoded operations and results of requests.
+ *
+ * Operations of a compound request are listed in one argument: they are
+ * separated by ';', and the method and every key and value of an operation
+ * by ','. In those fields every byte other than an ASCII letter, digit, '-',
+ * '.' or '_' is written as '~' and two hex digits, so the list contains no
+ * characters that URL decoding on the server would alter.
+ */
+struct networkfs_compound {
+  struct networkfs_transport *transport;
+  spinlock_t lock;
+  struct list_head queue;
+  size_t waiting;
+  unsigned int leaders;
+  bool unsupported;
+  mempool_t *requests;
+};
+
+int networkfs_compound_cache_init(void);
+
+void networkfs_compound_cache_exit(void);
+
+/**
+ * networkfs_compound_init - set up compound state of a mount.
+ *
+ * Return: zero, or -ENOMEM.
+ */
+int networkfs_compound_init(struct networkfs_compound *compound,
+                            struct networkfs_transport *transport);
+
+void networkfs_compound_destroy(struct networkfs_compound *compound);
+
+/**
+ * networkfs_compound_call - make a call, possibly as part of compound request.
+ * @compound: Compound state of the mount.
+ *
+ * Other arguments and the return value are the same as for
+ * networkfs_transport_call(). Only lookup, create, unlink, rmdir and link may
+ * be made this way: their responses fit into &struct compound_result.
+ */
+int64_t networkfs_compound_call(struct networkfs_compound *compound,
+                                const char *method, char *response_buffer,
+                                size_t buffer_size, size_t arg_size, ...);
+
+/**
+ * networkfs_compound_run - make a prepared call, possibly as part of
+ * compound request.
+ *
+ * Return: the same as networkfs_compound_call().
+ */
+int64_t networkfs_compound_run(struct networkfs_compound *compound,
+                               struct networkfs_call *call);
+
+/**
+ * networkfs_compound_parse - take the next operation of compound request.
+ * @ops:  Unparsed rest of the encoded operations, advanced past the taken
+ *        one. Fields are decoded in place.
+ * @call: Call whose method and arguments are set to the operation's ones.
+ *
+ * Return: 1 if an operation was taken, 0 if there are no more, or -EINVAL
+ * if the operation is malformed.
+ */
+int networkfs_compound_parse(char **ops, struct networkfs_call *call);
+
+#endif
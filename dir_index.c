@@ -0,0 +1,221 @@
+#include "dir_index.h"
+
+#include <linux/hash.h>
+#include <linux/jiffies.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/overflow.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/stringhash.h>
+
+struct networkfs_dir_index_entry {
+  struct hlist_node node;
+  u32 hash;
+  unsigned char entry_type;
+  ino_t ino;
+  char name[];
+};
+
+u32 networkfs_dir_index_hash(const char *name, size_t length) {
+  return full_name_hash(NULL, name, length);
+}
+
+struct networkfs_dir_index *networkfs_dir_index_create(unsigned long epoch) {
+  struct networkfs_dir_index *index =
+      kzalloc(sizeof(struct networkfs_dir_index), GFP_KERNEL);
+  if (index == NULL) {
+    return NULL;
+  }
+
+  index->time = jiffies;
+  index->epoch = epoch;
+  INIT_HLIST_HEAD(&index->pending);
+  return index;
+}
+
+struct networkfs_dir_index_entry *networkfs_dir_index_entry_create(
+    const struct entry *entry) {
+  size_t length = strnlen(entry->name, sizeof(entry->name));
+  struct networkfs_dir_index_entry *item =
+      kmalloc(struct_size(item, name, length + 1), GFP_KERNEL);
+  if (item == NULL) {
+    return NULL;
+  }
+
+  item->hash = networkfs_dir_index_hash(entry->name, length);
+  item->entry_type = entry->entry_type;
+  item->ino = entry->ino;
+  memcpy(item->name, entry->name, length);
+  item->name[length] = '\0';
+  return item;
+}
+
+int networkfs_dir_index_add(struct networkfs_dir_index *index,
+                            const struct entry *entry) {
+  struct networkfs_dir_index_entry *item =
+      networkfs_dir_index_entry_create(entry);
+  if (item == NULL) {
+    return -ENOMEM;
+  }
+
+  hlist_add_head(&item->node, &index->pending);
+  ++index->count;
+  return 0;
+}
+
+int networkfs_dir_index_seal(struct networkfs_dir_index *index) {
+  struct networkfs_dir_index_entry *item;
+  struct hlist_node *tmp;
+
+  index->bits =
+      index->count > 2 ? ilog2(roundup_pow_of_two(index->count)) : 1;
+  index->buckets =
+      kvcalloc(1 << index->bits, sizeof(struct hlist_head), GFP_KERNEL);
+  if (index->buckets == NULL) {
+    return -ENOMEM;
+  }
+
+  // Without the order walks skip entries from the start, which is slower
+  index->order = kvmalloc_array(index->count,
+                                sizeof(struct networkfs_dir_index_entry *),
+                                GFP_KERNEL);
+
+  size_t pos = 0;
+  hlist_for_each_entry_safe(item, tmp, &index->pending, node) {
+    hlist_del(&item->node);
+    hlist_add_head(&item->node,
+                   &index->buckets[hash_32(item->hash, index->bits)]);
+    if (index->order != NULL) {
+      index->order[pos++] = item;
+    }
+  }
+
+  return 0;
+}
+
+// Positions shift once entries are added or removed
+void networkfs_dir_index_drop_order(struct networkfs_dir_index *index) {
+  kvfree(index->order);
+  index->order = NULL;
+}
+
+struct networkfs_dir_index_entry *networkfs_dir_index_lookup(
+    const struct networkfs_dir_index *index, const char *name) {
+  size_t length = strlen(name);
+  u32 hash = networkfs_dir_index_hash(name, length);
+  struct networkfs_dir_index_entry *item;
+
+  hlist_for_each_entry(item, &index->buckets[hash_32(hash, index->bits)],
+                       node) {
+    if (item->hash == hash && strcmp(item->name, name) == 0) {
+      return item;
+    }
+  }
+
+  return NULL;
+}
+
+bool networkfs_dir_index_find(const struct networkfs_dir_index *index,
+                              const char *name, struct entry_info *info) {
+  struct networkfs_dir_index_entry *item =
+      networkfs_dir_index_lookup(index, name);
+  if (item == NULL) {
+    return false;
+  }
+
+  info->entry_type = item->entry_type;
+  info->ino = item->ino;
+  return true;
+}
+
+void networkfs_dir_index_remove(struct networkfs_dir_index *index,
+                                const char *name) {
+  struct networkfs_dir_index_entry *item =
+      networkfs_dir_index_lookup(index, name);
+  if (item != NULL) {
+    networkfs_dir_index_drop_order(index);
+    hlist_del(&item->node);
+    kfree(item);
+    --index->count;
+  }
+}
+
+int networkfs_dir_index_insert(struct networkfs_dir_index *index,
+                               const struct entry *entry) {
+  struct networkfs_dir_index_entry *item =
+      networkfs_dir_index_entry_create(entry);
+  if (item == NULL) {
+    return -ENOMEM;
+  }
+
+  networkfs_dir_index_remove(index, item->name);
+  networkfs_dir_index_drop_order(index);
+  hlist_add_head(&item->node,
+                 &index->buckets[hash_32(item->hash, index->bits)]);
+  ++index->count;
+  return 0;
+}
+
+size_t networkfs_dir_index_walk(const struct networkfs_dir_index *index,
+                                size_t pos,
+                                bool (*visit)(void *data, const char *name,
+                                              const struct entry_info *info),
+                                void *data) {
+  struct networkfs_dir_index_entry *item;
+  struct entry_info info = {};
+  size_t visited = 0;
+
+  if (index->order != NULL) {
+    for (; pos < index->count; pos++) {
+      item = index->order[pos];
+      info.entry_type = item->entry_type;
+      info.ino = item->ino;
+      if (!visit(data, item->name, &info)) {
+        break;
+      }
+      ++visited;
+    }
+    return visited;
+  }
+
+  for (size_t i = 0; i < (1 << index->bits); i++) {
+    hlist_for_each_entry(item, &index->buckets[i], node) {
+      if (pos > 0) {
+        --pos;
+        continue;
+      }
+      info.entry_type = item->entry_type;
+      info.ino = item->ino;
+      if (!visit(data, item->name, &info)) {
+        return visited;
+      }
+      ++visited;
+    }
+  }
+
+  return visited;
+}
+
+void networkfs_dir_index_free_list(struct hlist_head *head) {
+  struct networkfs_dir_index_entry *item;
+  struct hlist_node *tmp;
+
+  hlist_for_each_entry_safe(item, tmp, head, node) { kfree(item); }
+}
+
+void networkfs_dir_index_free(struct networkfs_dir_index *index) {
+  if (index == NULL) {
+    return;
+  }
+
+  networkfs_dir_index_free_list(&index->pending);
+  if (index->buckets != NULL) {
+    for (size_t i = 0; i < (1 << index->bits); i++) {
+      networkfs_dir_index_free_list(&index->buckets[i]);
+    }
+    kvfree(index->buckets);
+  }
+  kvfree(index->order);
+  kfree(index);
+}
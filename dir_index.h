@@ -0,0 +1,93 @@
+#ifndef NETWORKFS_DIR_INDEX
+#define NETWORKFS_DIR_INDEX
+
+#include <linux/list.h>
+#include <linux/types.h>
+
+#include "models.h"
+
+struct networkfs_dir_index_entry;
+
+/**
+ * struct networkfs_dir_index - names of a complete directory listing.
+ * @time:    When the listing was requested, in jiffies.
+ * @epoch:   Local change counter of the directory when the listing was
+ *           requested.
+ * @change:  Change attribute of the directory the listing reflects, 0 if
+ *           the server does not report it.
+ * @count:   Number of entries.
+ * @bits:    Log2 of the number of @buckets.
+ * @pending: Entries added so far, while @buckets is NULL.
+ * @buckets: Hash table of entries, once the index is sealed.
+ * @order:   Entries by position, from sealing until the first insert or
+ *           remove, so walks resume without skipping entries one by one.
+ *
+ * Entries are collected page by page while the listing streams in, and
+ * hashed into buckets sized for the final count when it is sealed.
+ */
+struct networkfs_dir_index {
+  unsigned long time;
+  unsigned long epoch;
+  u64 change;
+  size_t count;
+  unsigned int bits;
+  struct hlist_head pending;
+  struct hlist_head *buckets;
+  struct networkfs_dir_index_entry **order;
+};
+
+struct networkfs_dir_index *networkfs_dir_index_create(unsigned long epoch);
+
+int networkfs_dir_index_add(struct networkfs_dir_index *index,
+                            const struct entry *entry);
+
+int networkfs_dir_index_seal(struct networkfs_dir_index *index);
+
+/**
+ * networkfs_dir_index_find - look up a name in sealed index.
+ * @index: Sealed index.
+ * @name:  Name of the entry.
+ * @info:  Filled with type and inode number of the entry, if found.
+ *
+ * Return: true if the directory has such entry.
+ */
+bool networkfs_dir_index_find(const struct networkfs_dir_index *index,
+                              const char *name, struct entry_info *info);
+
+/**
+ * networkfs_dir_index_insert - add or replace an entry of sealed index.
+ * @index: Sealed index.
+ * @entry: Entry added to the directory.
+ *
+ * Buckets are not resized, so this suits small deltas.
+ *
+ * Return: 0 on success, -ENOMEM otherwise.
+ */
+int networkfs_dir_index_insert(struct networkfs_dir_index *index,
+                               const struct entry *entry);
+
+void networkfs_dir_index_remove(struct networkfs_dir_index *index,
+                                const char *name);
+
+/**
+ * networkfs_dir_index_walk - visit entries of sealed index.
+ * @index: Sealed index.
+ * @pos:   Number of entries to skip.
+ * @visit: Called for every entry in turn, stops the walk by returning false.
+ * @data:  Passed to @visit.
+ *
+ * Entries come in the same order on every walk while the index is not
+ * changed, so @pos can resume an earlier walk. Until the index is changed,
+ * the walk starts right at @pos.
+ *
+ * Return: number of entries @visit accepted.
+ */
+size_t networkfs_dir_index_walk(const struct networkfs_dir_index *index,
+                                size_t pos,
+                                bool (*visit)(void *data, const char *name,
+                                              const struct entry_info *info),
+                                void *data);
+
+void networkfs_dir_index_free(struct networkfs_dir_index *index);
+
+#endif
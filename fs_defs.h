@@ -1,20 +1,67 @@
+#include "models.h"
+#include "transport.h"
+
 struct inode *networkfs_get_inode(struct super_block *sb,
                                   const struct inode *parent, umode_t mode,
-                                  int i_ino);
+                                  ino_t i_ino);
 
 int networkfs_fill_super(struct super_block *sb, struct fs_context *fc);
 
 int networkfs_get_tree(struct fs_context *fc);
 
+int networkfs_parse_param(struct fs_context *fc, struct fs_parameter *param);
+
+int networkfs_reconfigure(struct fs_context *fc);
+
 int networkfs_init_fs_context(struct fs_context *fc);
 
+void networkfs_free_fs_context(struct fs_context *fc);
+
 void networkfs_kill_sb(struct super_block *sb);
 
 int networkfs_iterate(struct file *filp, struct dir_context *ctx);
 
+bool networkfs_snapshot_emit(void *data, const char *name,
+                             const struct entry_info *info);
+
+int networkfs_snapshot_iterate(struct file *filp, struct dir_context *ctx);
+
 struct dentry *networkfs_lookup(struct inode *parent, struct dentry *child,
                                 unsigned int flag);
 
+int networkfs_d_revalidate(struct dentry *dentry, unsigned int flags);
+
+void networkfs_index_sync(struct inode *inode, u64 since);
+
+struct dentry *networkfs_resolve_component(struct dentry *parent,
+                                           const char *name,
+                                           const struct entry_info *info);
+
+int networkfs_resolve(struct dentry *dentry, char *path,
+                      unsigned int *resolved);
+
+long networkfs_dir_ioctl(struct file *filp, unsigned int cmd,
+                         unsigned long arg);
+
+struct networkfs_sb_info;
+struct networkfs_prefetcher;
+struct networkfs_prefetch_item;
+
+bool networkfs_prefetch_wait(struct networkfs_sb_info *info);
+
+void networkfs_prefetch_queue(struct networkfs_sb_info *info,
+                              struct dentry *dentry, unsigned int depth);
+
+void networkfs_prefetch_page(struct networkfs_sb_info *info,
+                             struct networkfs_prefetch_item *item,
+                             const struct entries *entries);
+
+void networkfs_prefetch_work(struct work_struct *work);
+
+int networkfs_prefetcher_start(struct super_block *sb, unsigned int depth);
+
+void networkfs_prefetcher_stop(struct networkfs_sb_info *info);
+
 int networkfs_unlink(struct inode *parent, struct dentry *child);
 
 int networkfs_rmdir(struct inode *parent, struct dentry *child);
@@ -25,26 +72,150 @@ int networkfs_create(struct user_namespace *user_ns, struct inode *parent,
 int networkfs_mkdir(struct user_namespace *user_ns, struct inode *parent,
                     struct dentry *child, umode_t mode);
 
-int networkfs_iterate(struct file *filp, struct dir_context *ctx);
+int networkfs_link(struct dentry *old_dentry, struct inode *parent,
+                   struct dentry *new_dentry);
+
+struct inode *networkfs_alloc_inode(struct super_block *sb);
+
+void networkfs_destroy_inode(struct inode *inode);
+
+void networkfs_free_inode(struct inode *inode);
+
+int networkfs_show_stats(struct seq_file *m, struct dentry *root);
+
+loff_t networkfs_dir_llseek(struct file *filp, loff_t offset, int whence);
+
+int networkfs_dir_release(struct inode *inode, struct file *filp);
+
+void networkfs_set_etag(struct inode *inode, const char *etag);
+
+void networkfs_revalidate_content(struct inode *inode);
+
+int networkfs_file_open(struct inode *inode, struct file *filp);
+
+int networkfs_read_folio(struct file *file, struct folio *folio);
+
+void networkfs_readahead(struct readahead_control *rac);
+
+int networkfs_write_begin(struct file *file, struct address_space *mapping,
+                          loff_t pos, unsigned int len, struct page **pagep,
+                          void **fsdata);
+
+int networkfs_write_end(struct file *file, struct address_space *mapping,
+                        loff_t pos, unsigned int len, unsigned int copied,
+                        struct page *page, void *fsdata);
+
+int networkfs_writepages(struct address_space *mapping,
+                         struct writeback_control *wbc);
+
+int networkfs_fsync(struct file *file, loff_t start, loff_t end, int datasync);
+
+int networkfs_flush(struct file *file, fl_owner_t id);
+
+int networkfs_setattr(struct user_namespace *user_ns, struct dentry *dentry,
+                      struct iattr *attr);
+
+void networkfs_forget_entry(struct inode *dir, const char *name);
+
+void networkfs_watch_apply(struct super_block *sb,
+                           const struct watch_event *event);
+
+void networkfs_watch_lost(struct super_block *sb);
+
+int networkfs_watcher(void *data);
 
 int networkfs_init(void);
 
 void networkfs_exit(void);
 
-struct fs_context_operations networkfs_context_ops = {.get_tree =
-                                                          &networkfs_get_tree};
+enum networkfs_param {
+  Opt_transport,
+  Opt_server,
+  Opt_port,
+  Opt_lookup_ttl,
+  Opt_lookup_ttl_ms,
+  Opt_negative_ttl,
+  Opt_negative_ttl_ms,
+  Opt_rdirplus,
+  Opt_watch,
+  Opt_snapshot,
+  Opt_prefetch_depth
+};
+
+const struct constant_table networkfs_transport_types[] = {
+    {"http", NETWORKFS_TRANSPORT_HTTP},
+    {"loopback", NETWORKFS_TRANSPORT_LOOPBACK},
+    {}};
+
+const struct fs_parameter_spec networkfs_fs_parameters[] = {
+    fsparam_enum("transport", Opt_transport, networkfs_transport_types),
+    fsparam_string("server", Opt_server),
+    fsparam_u32("port", Opt_port),
+    fsparam_u32("lookup_ttl", Opt_lookup_ttl),
+    fsparam_u32("lookup_ttl_ms", Opt_lookup_ttl_ms),
+    fsparam_u32("negative_ttl", Opt_negative_ttl),
+    fsparam_u32("negative_ttl_ms", Opt_negative_ttl_ms),
+    fsparam_flag("rdirplus", Opt_rdirplus),
+    fsparam_flag("watch", Opt_watch),
+    fsparam_flag("snapshot", Opt_snapshot),
+    fsparam_u32("prefetch_depth", Opt_prefetch_depth),
+    {}};
+
+struct fs_context_operations networkfs_context_ops = {
+    .get_tree = &networkfs_get_tree,
+    .parse_param = &networkfs_parse_param,
+    .reconfigure = &networkfs_reconfigure,
+    .free = &networkfs_free_fs_context};
 
 struct file_system_type networkfs_fs_type = {
     .name = "networkfs",
     .init_fs_context = &networkfs_init_fs_context,
+    .parameters = networkfs_fs_parameters,
     .kill_sb = &networkfs_kill_sb};
 
 struct file_operations networkfs_dir_ops = {
-    .iterate = &networkfs_iterate,
+    .iterate_shared = &networkfs_iterate,
+    .llseek = &networkfs_dir_llseek,
+    .read = &generic_read_dir,
+    .release = &networkfs_dir_release,
+    .unlocked_ioctl = &networkfs_dir_ioctl,
+    .compat_ioctl = &compat_ptr_ioctl,
 };
 
+struct file_operations networkfs_file_ops = {
+    .open = &networkfs_file_open,
+    .llseek = &generic_file_llseek,
+    .read_iter = &generic_file_read_iter,
+    .write_iter = &generic_file_write_iter,
+    .mmap = &generic_file_mmap,
+    .splice_read = &generic_file_splice_read,
+    .splice_write = &iter_file_splice_write,
+    .fsync = &networkfs_fsync,
+    .flush = &networkfs_flush,
+};
+
+struct address_space_operations networkfs_aops = {
+    .read_folio = &networkfs_read_folio,
+    .readahead = &networkfs_readahead,
+    .write_begin = &networkfs_write_begin,
+    .write_end = &networkfs_write_end,
+    .dirty_folio = &filemap_dirty_folio,
+    .writepages = &networkfs_writepages,
+};
+
+struct super_operations networkfs_super_ops = {
+    .alloc_inode = &networkfs_alloc_inode,
+    .destroy_inode = &networkfs_destroy_inode,
+    .free_inode = &networkfs_free_inode,
+    .show_stats = &networkfs_show_stats};
+
+struct dentry_operations networkfs_dentry_ops = {
+    .d_revalidate = &networkfs_d_revalidate};
+
 struct inode_operations networkfs_inode_ops = {.lookup = &networkfs_lookup,
                                                .create = &networkfs_create,
                                                .unlink = &networkfs_unlink,
                                                .mkdir = &networkfs_mkdir,
-                                               .rmdir = &networkfs_rmdir};
+                                               .rmdir = &networkfs_rmdir,
+                                               .link = &networkfs_link,
+                                               .setattr = &networkfs_setattr};
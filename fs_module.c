@@ -1,38 +1,422 @@
 #include <linux/fs_context.h>
+#include <linux/fs_parser.h>
+#include <linux/inet.h>
+#include <linux/kthread.h>
+#include <linux/mempool.h>
 #include <linux/module.h>
+#include <linux/pagemap.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/writeback.h>
 
+#include "compound.h"
+#include "dir_index.h"
 #include "fs_defs.h"
 #include "http.h"
+#include "ioctl.h"
 #include "models.h"
+#include "singleflight.h"
+#include "snapshot.h"
+#include "transport.h"
 
-#define ALLOC_INO                                           \
-  char *ino_ascii = kmalloc(sizeof(ino_t) + 1, GFP_KERNEL); \
-  if (ino_ascii == NULL) {                                  \
-    ret = -ENOMEM;                                          \
-    goto ino_end;                                           \
+// Enough for decimal representation of any ino_t
+#define INO_ASCII_SIZE 21
+
+#define DECLARE_INO(ino)          \
+  char ino_ascii[INO_ASCII_SIZE]; \
+  snprintf(ino_ascii, sizeof(ino_ascii), "%lu", ino)
+
+#define TOKEN_PATTERN "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"
+
+#define MAX_TITLE_LEN 255
+
+#define DEFAULT_SERVER_IP "77.234.215.132"
+#define DEFAULT_SERVER_PORT 80
+
+// Milliseconds a looked up entry is trusted without asking the server again
+#define DEFAULT_LOOKUP_TTL MSEC_PER_SEC
+// Milliseconds a missing entry is remembered as missing
+#define DEFAULT_NEGATIVE_TTL MSEC_PER_SEC
+
+// Entries requested per list_page call, fits into struct entries
+#define LIST_PAGE_LIMIT "16"
+
+// Lookups this soon after reading the directory count as stat-after-readdir
+#define READDIR_PLUS_WINDOW (2 * HZ)
+
+// Seconds the server may hold a watch call without events
+#define WATCH_TIMEOUT "30"
+// Pause before watching again after a failed call
+#define WATCH_RETRY_DELAY (5 * HZ)
+
+// Directories listed by the prefetcher at once
+#define PREFETCH_CONCURRENCY 4
+// Pause of the prefetcher while foreground calls are in progress
+#define PREFETCH_BACKOFF (HZ / 10)
+// Prefetching stops for this long after memory was reclaimed
+#define PREFETCH_PRESSURE_BACKOFF (5 * HZ)
+
+// Components resolved by one call
+#define RESOLVE_MAX_COMPONENTS \
+  ARRAY_SIZE(((struct resolved_path *)0)->components)
+
+// Longest file content the server stores
+#define CONTENT_MAX_SIZE sizeof(((struct content *)0)->content)
+// Size of an entry answered locally or by an old server
+#define ENTRY_SIZE_UNKNOWN U64_MAX
+
+// Content buffers kept in reserve for each mount
+#define MIN_CONTENT_BUFFERS 2
+
+// Bits of networkfs_inode flags
+#define NETWORKFS_I_PREFETCHED 0  // directory was queued for prefetching
+
+struct kmem_cache *networkfs_dir_cachep;
+struct kmem_cache *networkfs_inode_cachep;
+struct kmem_cache *networkfs_content_cachep;
+
+struct networkfs_inode {
+  // Bumped whenever an entry is added to the directory through this mount,
+  // so negative dentries cached under it are looked up again.
+  unsigned long generation;
+  // Last listing of the directory, in jiffies
+  unsigned long readdir_time;
+  // Children were looked up right after listing, so listing primes dcache
+  bool readdir_plus;
+  // Protects @index
+  spinlock_t index_lock;
+  // Names of the last complete listing, answers lookups while it is fresh
+  struct networkfs_dir_index *index;
+  // Bumped on every local change of entries, so listings started before
+  // the change are not indexed
+  unsigned long index_epoch;
+  // Change attribute reported by the server, 0 if unknown. Protected by
+  // i_lock together with the times it was first seen and last confirmed.
+  u64 change;
+  unsigned long change_since;
+  unsigned long change_time;
+  // Entity tag of the file content in the page cache, empty if unknown.
+  // Protected by i_lock.
+  char etag[NETWORKFS_ETAG_SIZE];
+  unsigned long flags;
+  struct inode vfs_inode;
+};
+
+#define NETWORKFS_I(inode) \
+  container_of(inode, struct networkfs_inode, vfs_inode)
+
+struct networkfs_sb_info {
+  struct networkfs_transport *transport;
+  struct networkfs_compound compound;  // groups concurrent calls
+  struct networkfs_singleflight singleflight;  // shares identical calls
+  unsigned long lookup_ttl;    // in jiffies
+  unsigned long negative_ttl;  // in jiffies
+  bool no_list_page;           // server predates paginated listing
+  bool no_getattr;             // server does not report change attributes
+  bool no_list_changes;        // server keeps no change log
+  bool no_resolve;             // server looks up one component at a time
+  bool rdirplus;               // listings may populate dcache
+  struct task_struct *watcher;  // applies events pushed by the server
+  unsigned long trusted_since;  // nothing cached earlier is trusted
+  struct networkfs_snapshot *snapshot;  // whole tree of read-only mounts
+  struct networkfs_prefetcher *prefetcher;  // NULL unless prefetching
+  mempool_t *contents;  // union networkfs_content_buffer, too large for stack
+};
+
+// Crawls the tree breadth-first in the background, so that listings,
+// dentries and inodes are cached before they are asked for.
+struct networkfs_prefetcher {
+  struct workqueue_struct *wq;  // runs PREFETCH_CONCURRENCY items at most
+  struct shrinker shrinker;     // notices memory pressure
+  unsigned int depth;           // levels crawled below a directory
+  atomic_t queued;              // items not finished yet
+  atomic_t listing;             // calls of the prefetcher in progress
+  unsigned long pressure_time;  // when memory was last reclaimed
+  bool stopping;                // set at unmount, queued items are dropped
+};
+
+struct networkfs_prefetch_item {
+  struct work_struct work;
+  struct dentry *dentry;  // directory to list
+  unsigned int depth;     // levels to crawl, including @dentry
+};
+
+// Position of an open directory in its listing. Only the page around the
+// position is kept, so memory does not grow with the directory.
+struct networkfs_dir_cursor {
+  bool valid;
+  loff_t page_pos;  // ctx->pos of the first entry of the page
+  struct networkfs_dir_index *index;  // built while listing from the start
+  struct entries_page page;
+};
+
+// Mount options collected before the superblock exists
+struct networkfs_mount_config {
+  struct networkfs_transport_config transport;
+  unsigned int lookup_ttl;    // in milliseconds
+  unsigned int negative_ttl;  // in milliseconds
+  bool rdirplus;
+  bool watch;
+  bool snapshot;
+  unsigned int prefetch_depth;
+};
+
+int check_name_len(const char *name) { return strlen(name) > MAX_TITLE_LEN; }
+
+// Whether something cached at @time may be trusted for its TTL. It may not
+// once the watch lost events after it was cached.
+bool networkfs_trusted(const struct networkfs_sb_info *info,
+                       unsigned long time) {
+  return !time_before(time, READ_ONCE(info->trusted_since));
+}
+
+// Remembers that @dentry has no inode as of now
+void networkfs_set_negative(struct inode *parent, struct dentry *dentry) {
+  WRITE_ONCE(dentry->d_fsdata,
+             (void *)READ_ONCE(NETWORKFS_I(parent)->generation));
+  WRITE_ONCE(dentry->d_time, jiffies);
+}
+
+// Makers of calls shared through networkfs_singleflight_call()
+int64_t networkfs_run_direct(void *transport, struct networkfs_call *call) {
+  return networkfs_call_run(transport, call);
+}
+
+int64_t networkfs_run_compound(void *compound, struct networkfs_call *call) {
+  return networkfs_compound_run(compound, call);
+}
+
+// Makes a read-only call. Identical calls in progress share one request.
+int64_t networkfs_shared_call(struct networkfs_sb_info *info,
+                              const char *method, char *response_buffer,
+                              size_t buffer_size, size_t arg_size, ...) {
+  struct networkfs_call call;
+  va_list args;
+
+  va_start(args, arg_size);
+  int error = networkfs_call_vinit(&call, method, response_buffer,
+                                   buffer_size, arg_size, args);
+  va_end(args);
+  if (error != 0) {
+    return error;
   }
 
-#define FREE_INO    \
-  kfree(ino_ascii); \
-  ino_end:
+  return networkfs_singleflight_call(&info->singleflight, &call,
+                                     networkfs_run_direct, info->transport);
+}
+
+int64_t networkfs_fetch_attr(struct inode *inode, struct attr_info *attr) {
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+
+  if (READ_ONCE(info->no_getattr)) {
+    return -EOPNOTSUPP;
+  }
 
-#define ALLOC_BUF(model)                            \
-  size_t buffer_size = sizeof(model);               \
-  model *buffer = kmalloc(buffer_size, GFP_KERNEL); \
-  if (buffer == NULL) {                             \
-    ret = -ENOMEM;                                  \
-    goto buf_end;                                   \
+  memset(attr, 0, sizeof(struct attr_info));
+  DECLARE_INO(inode->i_ino);
+  int64_t ret = networkfs_shared_call(info, "getattr", (char *)attr,
+                                      sizeof(struct attr_info), 1, "inode",
+                                      ino_ascii);
+  if (ret == -EHTTPBADCODE || (ret == 0 && attr->change == 0)) {
+    WRITE_ONCE(info->no_getattr, true);
   }
+  return ret;
+}
 
-#define FREE_BUF \
-  kfree(buffer); \
-  buf_end:
+// Records change attribute of @inode reported by the server
+void networkfs_set_change(struct inode *inode, u64 change) {
+  struct networkfs_inode *ni = NETWORKFS_I(inode);
 
-#define TOKEN_PATTERN "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"
+  if (change == 0) {
+    return;
+  }
 
-#define MAX_TITLE_LEN 255
+  spin_lock(&inode->i_lock);
+  if (change != ni->change) {
+    ni->change = change;
+    ni->change_since = jiffies;
+  }
+  ni->change_time = jiffies;
+  spin_unlock(&inode->i_lock);
+}
 
-int check_name_len(const char *name) { return strlen(name) > MAX_TITLE_LEN; }
+void networkfs_set_size(struct inode *inode, uint64_t size) {
+  spin_lock(&inode->i_lock);
+  i_size_write(inode, min_t(uint64_t, size, CONTENT_MAX_SIZE));
+  spin_unlock(&inode->i_lock);
+}
+
+// Records attributes of @inode the server reported with its entry. Size of a
+// file is taken unless local writes are newer, so stat is right before open.
+void networkfs_set_entry(struct inode *inode, const struct entry_info *entry) {
+  networkfs_set_change(inode, entry->change);
+  if (S_ISREG(inode->i_mode) && entry->size != ENTRY_SIZE_UNKNOWN &&
+      !mapping_tagged(inode->i_mapping, PAGECACHE_TAG_DIRTY) &&
+      !mapping_tagged(inode->i_mapping, PAGECACHE_TAG_WRITEBACK)) {
+    networkfs_set_size(inode, entry->size);
+  }
+}
+
+// Returns change attribute of @inode confirmed within lookup_ttl, asking the
+// server with getattr when needed, or 0 if it is unknown. *since is set to
+// the time the attribute was first seen.
+u64 networkfs_confirm_change(struct inode *inode, unsigned long *since) {
+  struct networkfs_inode *ni = NETWORKFS_I(inode);
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+  struct attr_info attr;
+
+  spin_lock(&inode->i_lock);
+  bool fresh = ni->change != 0 &&
+               time_before(jiffies, ni->change_time + info->lookup_ttl) &&
+               networkfs_trusted(info, ni->change_time);
+  spin_unlock(&inode->i_lock);
+
+  if (!fresh) {
+    if (networkfs_fetch_attr(inode, &attr) != 0) {
+      return 0;
+    }
+    networkfs_set_change(inode, attr.change);
+  }
+
+  spin_lock(&inode->i_lock);
+  u64 change = ni->change;
+  if (since != NULL) {
+    *since = ni->change_since;
+  }
+  spin_unlock(&inode->i_lock);
+
+  return change;
+}
+
+// Whether directory @inode is known to keep the same entries since @time.
+// Costs at most one tiny getattr call per lookup_ttl.
+bool networkfs_unchanged_since(struct inode *inode, unsigned long time) {
+  unsigned long since;
+  return networkfs_confirm_change(inode, &since) != 0 &&
+         !time_before(time, since);
+}
+
+// Replaces the index of @inode, unless its entries changed since @index
+// listing was started
+void networkfs_index_publish(struct inode *inode,
+                             struct networkfs_dir_index *index) {
+  struct networkfs_inode *dir = NETWORKFS_I(inode);
+
+  spin_lock(&dir->index_lock);
+  if (index == NULL || index->epoch == dir->index_epoch) {
+    swap(dir->index, index);
+  }
+  spin_unlock(&dir->index_lock);
+
+  networkfs_dir_index_free(index);
+}
+
+void networkfs_index_drop(struct inode *inode) {
+  struct networkfs_inode *dir = NETWORKFS_I(inode);
+
+  spin_lock(&dir->index_lock);
+  ++dir->index_epoch;
+  spin_unlock(&dir->index_lock);
+
+  networkfs_index_publish(inode, NULL);
+}
+
+unsigned long networkfs_index_epoch(struct inode *inode) {
+  struct networkfs_inode *dir = NETWORKFS_I(inode);
+
+  spin_lock(&dir->index_lock);
+  unsigned long epoch = dir->index_epoch;
+  spin_unlock(&dir->index_lock);
+
+  return epoch;
+}
+
+// Answers lookup from the index while it is within lookup_ttl, or while the
+// change attribute of the directory matches the listing. Returns -EAGAIN
+// when the server has to be asked.
+int64_t networkfs_index_lookup(struct inode *parent, const char *name,
+                               struct entry_info *entry) {
+  struct networkfs_inode *dir = NETWORKFS_I(parent);
+  struct networkfs_sb_info *info = parent->i_sb->s_fs_info;
+  int64_t ret = -EAGAIN;
+
+  spin_lock(&dir->index_lock);
+  bool stale = dir->index != NULL &&
+               (!time_before(jiffies, dir->index->time + info->lookup_ttl) ||
+                !networkfs_trusted(info, dir->index->time));
+  u64 change = dir->index != NULL ? dir->index->change : 0;
+  spin_unlock(&dir->index_lock);
+
+  if (stale && change != 0) {
+    u64 current_change = networkfs_confirm_change(parent, NULL);
+    if (current_change == change) {
+      spin_lock(&dir->index_lock);
+      if (dir->index != NULL && dir->index->change == change) {
+        dir->index->time = jiffies;
+      }
+      spin_unlock(&dir->index_lock);
+    } else if (current_change != 0) {
+      networkfs_index_sync(parent, change);
+    }
+  }
+
+  spin_lock(&dir->index_lock);
+  if (dir->index != NULL &&
+      time_before(jiffies, dir->index->time + info->lookup_ttl) &&
+      networkfs_trusted(info, dir->index->time)) {
+    ret = networkfs_dir_index_find(dir->index, name, entry)
+              ? NETWORKFS_OK
+              : NETWORKFS_ENOENT_DIR;
+  }
+  spin_unlock(&dir->index_lock);
+
+  return ret;
+}
+
+void networkfs_dir_changed(struct inode *dir) {
+  WRITE_ONCE(NETWORKFS_I(dir)->generation,
+             READ_ONCE(NETWORKFS_I(dir)->generation) + 1);
+  networkfs_index_drop(dir);
+}
+
+int64_t networkfs_lookup_entry(struct inode *parent, const char *name,
+                               struct entry_info *entry) {
+  struct networkfs_sb_info *info = parent->i_sb->s_fs_info;
+
+  memset(entry, 0, sizeof(struct entry_info));
+  // Kept by indexes and by responses of old servers, which are shorter
+  entry->size = ENTRY_SIZE_UNKNOWN;
+  if (info->snapshot != NULL) {
+    struct networkfs_dir_index *dir =
+        networkfs_snapshot_dir(info->snapshot, parent->i_ino);
+    return dir != NULL && networkfs_dir_index_find(dir, name, entry)
+               ? NETWORKFS_OK
+               : NETWORKFS_ENOENT_DIR;
+  }
+
+  int64_t ret = networkfs_index_lookup(parent, name, entry);
+  if (ret != -EAGAIN) {
+    return ret;
+  }
+
+  struct networkfs_call call;
+  DECLARE_INO(parent->i_ino);
+  networkfs_call_init(&call, "lookup", (char *)entry, sizeof(struct entry_info),
+                      2, "parent", ino_ascii, "name", name);
+  return networkfs_singleflight_call(&info->singleflight, &call,
+                                     networkfs_run_compound, &info->compound);
+}
+
+umode_t networkfs_entry_mode(unsigned char entry_type) {
+  switch (entry_type) {
+    case DT_DIR:
+      return S_IFDIR;
+    case DT_REG:
+      return S_IFREG;
+    default:
+      return 0;
+  }
+}
 
 struct dentry *networkfs_lookup(struct inode *parent, struct dentry *child,
                                 unsigned int flag) {
@@ -40,54 +424,169 @@ struct dentry *networkfs_lookup(struct inode *parent, struct dentry *child,
   if (check_name_len(name)) {
     return NULL;
   }
-  const char *token = parent->i_sb->s_fs_info;
-  uint64_t ret;
-  ALLOC_BUF(struct entry_info)
-  ALLOC_INO
-  sprintf(ino_ascii, "%lu", parent->i_ino);
-  ret = networkfs_http_call(token, "lookup", (char *)buffer, buffer_size, 2,
-                            "parent", ino_ascii, "name", name);
-  if (ret != 0) {
-    goto free;
+  struct networkfs_inode *dir = NETWORKFS_I(parent);
+  if (time_before(jiffies,
+                  READ_ONCE(dir->readdir_time) + READDIR_PLUS_WINDOW)) {
+    WRITE_ONCE(dir->readdir_plus, true);
   }
 
-  umode_t mode;
-  switch (buffer->entry_type) {
-    case DT_DIR:
-      mode = S_IFDIR;
-      break;
-    case DT_REG:
-      mode = S_IFREG;
-      break;
-    default:
-      goto free;
+  struct entry_info buffer;
+  int64_t ret = networkfs_lookup_entry(parent, name, &buffer);
+  if (ret == NETWORKFS_ENOENT_DIR) {
+    networkfs_set_negative(parent, child);
+    d_add(child, NULL);
+    return NULL;
+  } else if (ret != 0) {
+    return NULL;
+  }
+
+  umode_t mode = networkfs_entry_mode(buffer.entry_type);
+  if (mode == 0) {
+    return NULL;
   }
 
   struct inode *inode =
-      networkfs_get_inode(parent->i_sb, NULL, mode | S_IRWXUGO, buffer->ino);
+      networkfs_get_inode(parent->i_sb, NULL, mode | S_IRWXUGO, buffer.ino);
+  if (inode == NULL) {
+    return NULL;
+  }
+  networkfs_set_entry(inode, &buffer);
+  child->d_time = jiffies;
+
+  struct dentry *alias = d_splice_alias(inode, child);
+  if (!IS_ERR_OR_NULL(alias)) {
+    // Directory kept its existing dentry, which the lookup confirmed as well
+    WRITE_ONCE(alias->d_time, jiffies);
+  }
+  return alias;
+}
+
+// Negative dentry is valid for negative_ttl, unless something was added to
+// its directory in the meantime. After that it is still valid if the
+// directory did not change on the server. Does not sleep in RCU-walk:
+// inodes are freed only after a grace period.
+int networkfs_revalidate_negative(struct dentry *dentry, unsigned int flags) {
+  struct networkfs_sb_info *info = dentry->d_sb->s_fs_info;
+  struct dentry *parent = READ_ONCE(dentry->d_parent);
+  struct inode *dir = d_inode_rcu(parent);
+
+  if (dir == NULL || (unsigned long)READ_ONCE(dentry->d_fsdata) !=
+                         READ_ONCE(NETWORKFS_I(dir)->generation)) {
+    return 0;
+  }
+  if (time_before(jiffies, READ_ONCE(dentry->d_time) + info->negative_ttl) &&
+      networkfs_trusted(info, READ_ONCE(dentry->d_time))) {
+    return 1;
+  }
+  if (READ_ONCE(NETWORKFS_I(dir)->change) == 0) {
+    return 0;
+  }
+  if (flags & LOOKUP_RCU) {
+    return -ECHILD;
+  }
+
+  if (!networkfs_unchanged_since(dir, dentry->d_time)) {
+    return 0;
+  }
+  WRITE_ONCE(dentry->d_time, jiffies);
+  return 1;
+}
+
+// Trusts the dentry for lookup_ttl after it was looked up. Then it is still
+// valid if its directory did not change, otherwise the server is asked
+// whether the name still refers to the same inode. Only the server round
+// trips need to leave RCU-walk, fresh and stale answers do not.
+int networkfs_d_revalidate(struct dentry *dentry, unsigned int flags) {
+  struct networkfs_sb_info *info = dentry->d_sb->s_fs_info;
+  struct inode *inode = d_inode_rcu(dentry);
+
+  if (info->snapshot != NULL) {
+    // Tree of the snapshot does not change while mounted
+    return 1;
+  }
   if (inode == NULL) {
-    goto free;
+    return networkfs_revalidate_negative(dentry, flags);
+  }
+  if (time_before(jiffies, READ_ONCE(dentry->d_time) + info->lookup_ttl) &&
+      networkfs_trusted(info, READ_ONCE(dentry->d_time))) {
+    return 1;
+  }
+  if (flags & LOOKUP_RCU) {
+    return -ECHILD;
+  }
+
+  struct dentry *parent = dget_parent(dentry);
+  if (networkfs_unchanged_since(d_inode(parent), dentry->d_time)) {
+    dput(parent);
+    WRITE_ONCE(dentry->d_time, jiffies);
+    return 1;
+  }
+
+  struct entry_info buffer;
+  int64_t ret = networkfs_lookup_entry(d_inode(parent), dentry->d_name.name,
+                                       &buffer);
+  dput(parent);
+
+  if (ret != 0 || buffer.ino != inode->i_ino ||
+      networkfs_entry_mode(buffer.entry_type) != (inode->i_mode & S_IFMT)) {
+    return 0;
   }
-  d_add(child, inode);
 
-free:
-  FREE_INO
-  FREE_BUF
-  return NULL;
+  networkfs_set_entry(inode, &buffer);
+  WRITE_ONCE(dentry->d_time, jiffies);
+  return 1;
+}
+
+// Turns a status reported by the server into negated errno for the VFS.
+// Negated errors of the transport are passed through.
+int networkfs_status_errno(int64_t ret) {
+  switch (ret) {
+    case NETWORKFS_OK:
+      return 0;
+    case NETWORKFS_ENOENT:
+    case NETWORKFS_ENOENT_DIR:
+      return -ENOENT;
+    case NETWORKFS_ENOTFILE:
+      // Only regular files may be linked or unlinked
+      return -EPERM;
+    case NETWORKFS_ENOTDIR:
+      return -ENOTDIR;
+    case NETWORKFS_EEXIST:
+      return -EEXIST;
+    case NETWORKFS_EFBIG:
+      return -EFBIG;
+    case NETWORKFS_EDIRFULL:
+      return -ENOSPC;
+    case NETWORKFS_ENOTEMPTY:
+      return -ENOTEMPTY;
+    case NETWORKFS_ENAMETOOLONG:
+      return -ENAMETOOLONG;
+    default:
+      return ret < 0 ? ret : -EIO;
+  }
 }
 
 int networkfs_rm_impl(struct inode *parent, struct dentry *child,
                       const char *method) {
   const char *name = child->d_name.name;
-  const char *token = parent->i_sb->s_fs_info;
-  uint64_t ret;
-  ALLOC_INO
-  sprintf(ino_ascii, "%lu", parent->i_ino);
-  ret = networkfs_http_call(token, method, NULL, 0, 2, "parent", ino_ascii,
-                            "name", name);
-
-  FREE_INO
-  return ret;
+  struct networkfs_sb_info *info = parent->i_sb->s_fs_info;
+  DECLARE_INO(parent->i_ino);
+  int64_t ret = networkfs_compound_call(&info->compound, method, NULL, 0, 2,
+                                        "parent", ino_ascii, "name", name);
+  if (ret == 0) {
+    struct inode *inode = d_inode(child);
+    // The server does not report link counts, so a file may have names not
+    // known here and keeps its last link. vfs_link refuses unlinked inodes.
+    if (S_ISDIR(inode->i_mode)) {
+      clear_nlink(inode);
+    } else if (inode->i_nlink > 1) {
+      drop_nlink(inode);
+    }
+    networkfs_index_drop(parent);
+    // VFS keeps the dentry as negative when nobody else uses it
+    networkfs_set_negative(parent, child);
+  }
+  return networkfs_status_errno(ret);
 }
 
 int networkfs_unlink(struct inode *parent, struct dentry *child) {
@@ -104,28 +603,27 @@ int networkfs_create_impl(struct inode *parent, struct dentry *child,
   if (check_name_len(name)) {
     return -1;
   }
-  const char *token = parent->i_sb->s_fs_info;
-  uint64_t ret;
-  ALLOC_BUF(struct create_info)
-  ALLOC_INO
-  sprintf(ino_ascii, "%lu", parent->i_ino);
-  ret = networkfs_http_call(token, "create", (char *)buffer, buffer_size, 3,
-                            "parent", ino_ascii, "name", name, "type", type);
+  struct networkfs_sb_info *info = parent->i_sb->s_fs_info;
+  struct create_info buffer;
+  int64_t ret;
+  DECLARE_INO(parent->i_ino);
+  ret = networkfs_compound_call(&info->compound, "create", (char *)&buffer,
+                                sizeof(buffer), 3, "parent", ino_ascii, "name",
+                                name, "type", type);
   if (ret != 0) {
-    goto free;
+    return networkfs_status_errno(ret);
   }
   struct inode *inode =
-      networkfs_get_inode(parent->i_sb, NULL, mode, buffer->ino);
+      networkfs_get_inode(parent->i_sb, NULL, mode, buffer.ino);
   if (inode == NULL) {
-    ret = -1;
-    goto free;
+    return -1;
   }
-  d_add(child, inode);
+  networkfs_dir_changed(parent);
+  child->d_time = jiffies;
+  // Name may be hashed already as a negative dentry
+  d_instantiate(child, inode);
 
-free:
-  FREE_BUF
-  FREE_INO
-  return ret;
+  return 0;
 }
 
 int networkfs_create(struct user_namespace *user_ns, struct inode *parent,
@@ -140,111 +638,1540 @@ int networkfs_mkdir(struct user_namespace *user_ns, struct inode *parent,
                                "directory");
 }
 
-int networkfs_iterate(struct file *filp, struct dir_context *ctx) {
-  struct dentry *dentry = filp->f_path.dentry;
-  struct inode *inode = dentry->d_inode;
-  const char *token = inode->i_sb->s_fs_info;
-  struct entry *current_entry;
-  int64_t ret;
+int networkfs_link(struct dentry *old_dentry, struct inode *parent,
+                   struct dentry *new_dentry) {
+  const char *name = new_dentry->d_name.name;
+  if (check_name_len(name)) {
+    return -ENAMETOOLONG;
+  }
+  struct inode *inode = d_inode(old_dentry);
+  struct networkfs_sb_info *info = parent->i_sb->s_fs_info;
+  DECLARE_INO(parent->i_ino);
+  char source_ascii[INO_ASCII_SIZE];
+  snprintf(source_ascii, sizeof(source_ascii), "%lu", inode->i_ino);
 
-  ALLOC_BUF(struct entries)
-  ALLOC_INO
-  sprintf(ino_ascii, "%lu", inode->i_ino);
-  ret = networkfs_http_call(token, "list", (char *)buffer, buffer_size, 1,
-                            "inode", ino_ascii);
+  int64_t ret = networkfs_compound_call(&info->compound, "link", NULL, 0, 3,
+                                        "source", source_ascii, "parent",
+                                        ino_ascii, "name", name);
   if (ret != 0) {
-    goto free;
-  }
-  loff_t start_cnt = ctx->pos;
-  size_t files_cnt = buffer->entries_count + 2;
-  while (ctx->pos < files_cnt) {
-    switch (ctx->pos) {
-      case 0:
-        dir_emit(ctx, ".", 1, inode->i_ino, DT_DIR);
-        break;
-      case 1:
-        dir_emit(ctx, "..", 2, dentry->d_parent->d_inode->i_ino, DT_DIR);
-        break;
-      default:
-        current_entry = buffer->entries + ctx->pos - 2;
-        dir_emit(ctx, current_entry->name, strlen(current_entry->name),
-                 current_entry->ino, current_entry->entry_type);
-    }
-    ++ctx->pos;
-  }
-  ret = files_cnt - start_cnt;
-
-free:
-  FREE_INO
-  FREE_BUF
-  return ret;
+    return networkfs_status_errno(ret);
+  }
+
+  networkfs_dir_changed(parent);
+  inc_nlink(inode);
+  ihold(inode);
+  new_dentry->d_time = jiffies;
+  d_instantiate(new_dentry, inode);
+
+  return 0;
 }
 
-struct inode *networkfs_get_inode(struct super_block *sb,
-                                  const struct inode *parent, umode_t mode,
-                                  int i_ino) {
-  struct inode *inode;
-  inode = new_inode(sb);
+// Adds the fetched page to the index being built, and publishes the index
+// once the last page is in
+void networkfs_index_page(struct inode *inode,
+                          struct networkfs_dir_cursor *dir) {
+  struct entries *entries = &dir->page.entries;
 
-  if (inode != NULL) {
-    inode->i_ino = i_ino;
-    inode->i_op = &networkfs_inode_ops;
-    inode->i_fop = &networkfs_dir_ops;
-    inode_init_owner(&init_user_ns, inode, parent, mode);
+  networkfs_set_change(inode, dir->page.change);
+  if (dir->index == NULL) {
+    return;
   }
 
-  return inode;
+  if (dir->index->count == 0) {
+    dir->index->change = dir->page.change;
+  } else if (dir->index->change != dir->page.change) {
+    // Directory changed while it was listed
+    networkfs_dir_index_free(dir->index);
+    dir->index = NULL;
+    return;
+  }
+
+  for (size_t i = 0; i < entries->entries_count; i++) {
+    if (networkfs_dir_index_add(dir->index, &entries->entries[i]) != 0) {
+      networkfs_dir_index_free(dir->index);
+      dir->index = NULL;
+      return;
+    }
+  }
+
+  if (dir->page.next_cursor == 0) {
+    if (networkfs_dir_index_seal(dir->index) == 0) {
+      networkfs_index_publish(inode, dir->index);
+    } else {
+      networkfs_dir_index_free(dir->index);
+    }
+    dir->index = NULL;
+  }
 }
 
-int networkfs_fill_super(struct super_block *sb, struct fs_context *fc) {
-  struct inode *inode =
-      networkfs_get_inode(sb, NULL, S_IFDIR | S_IRWXUGO, 1000);
-  sb->s_root = d_make_root(inode);
+// Fetches the page of @inode listing that starts at @cursor. Servers without
+// list_page send the whole listing as a single page.
+int networkfs_list_page(struct inode *inode, struct networkfs_dir_cursor *dir,
+                        uint64_t cursor, loff_t page_pos) {
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+  int64_t ret = -EHTTPBADCODE;
+  char cursor_ascii[INO_ASCII_SIZE];
+  DECLARE_INO(inode->i_ino);
 
-  if (sb->s_root == NULL) {
-    return -ENOMEM;
+  dir->valid = false;
+  if (cursor == 0) {
+    networkfs_dir_index_free(dir->index);
+    dir->index = networkfs_dir_index_create(networkfs_index_epoch(inode));
   }
-  sb->s_fs_info = kmalloc(sizeof(TOKEN_PATTERN), GFP_KERNEL);
-  if (sb->s_fs_info == NULL) {
-    return -ENOMEM;
+  if (!READ_ONCE(info->no_list_page)) {
+    snprintf(cursor_ascii, sizeof(cursor_ascii), "%llu", cursor);
+    ret = networkfs_shared_call(info, "list_page", (char *)&dir->page,
+                                sizeof(struct entries_page), 3, "inode",
+                                ino_ascii, "cursor", cursor_ascii, "limit",
+                                LIST_PAGE_LIMIT);
+    if (ret == -EHTTPBADCODE) {
+      WRITE_ONCE(info->no_list_page, true);
+    }
+  }
+  if (ret == -EHTTPBADCODE && cursor == 0) {
+    dir->page.next_cursor = 0;
+    dir->page.change = 0;
+    ret = networkfs_shared_call(info, "list", (char *)&dir->page.entries,
+                                sizeof(struct entries), 1, "inode",
+                                ino_ascii);
   }
-  strcpy(sb->s_fs_info, fc->source);
 
+  size_t count = dir->page.entries.entries_count;
+  if (ret != 0 || count > ARRAY_SIZE(dir->page.entries.entries) ||
+      (count == 0 && dir->page.next_cursor != 0)) {
+    networkfs_dir_index_free(dir->index);
+    dir->index = NULL;
+    return -EIO;
+  }
+  dir->page_pos = page_pos;
+  dir->valid = true;
+
+  networkfs_index_page(inode, dir);
   return 0;
 }
 
-int networkfs_get_tree(struct fs_context *fc) {
-  int ret = get_tree_nodev(fc, &networkfs_fill_super);
+// Instantiates dentry for a listed child, like a lookup that already knows
+// the answer. Existing dentries are only refreshed. Called with @parent's
+// inode locked at least shared, so the listing cannot be spliced around a
+// concurrent create or unlink.
+void networkfs_prime_dentry(struct dentry *parent, const struct entry *entry) {
+  struct qstr name = QSTR_INIT(entry->name, strlen(entry->name));
+  umode_t mode = networkfs_entry_mode(entry->entry_type);
+  DECLARE_WAIT_QUEUE_HEAD_ONSTACK(wq);
+  struct dentry *dentry;
 
-  if (ret != 0) {
-    printk(KERN_ERR "networkfs: unable to mount: error code %d", ret);
+  if (mode == 0 || name.len == 0 || name.len > MAX_TITLE_LEN) {
+    return;
   }
+  name.hash = full_name_hash(parent, name.name, name.len);
 
-  return ret;
+  dentry = d_lookup(parent, &name);
+  if (dentry == NULL) {
+    dentry = d_alloc_parallel(parent, &name, &wq);
+    if (IS_ERR(dentry)) {
+      return;
+    }
+  }
+
+  if (!d_in_lookup(dentry)) {
+    struct inode *inode = d_inode(dentry);
+    if (inode != NULL && inode->i_ino == entry->ino &&
+        !inode_wrong_type(inode, mode)) {
+      WRITE_ONCE(dentry->d_time, jiffies);
+    }
+    dput(dentry);
+    return;
+  }
+
+  struct inode *inode = networkfs_get_inode(parent->d_sb, NULL,
+                                            mode | S_IRWXUGO, entry->ino);
+  if (inode == NULL) {
+    d_lookup_done(dentry);
+    dput(dentry);
+    return;
+  }
+  dentry->d_time = jiffies;
+  struct dentry *alias = d_splice_alias(inode, dentry);
+  d_lookup_done(dentry);
+  if (!IS_ERR_OR_NULL(alias)) {
+    WRITE_ONCE(alias->d_time, jiffies);
+    dput(alias);
+  }
+  dput(dentry);
 }
 
-int networkfs_init_fs_context(struct fs_context *fc) {
-  fc->ops = &networkfs_context_ops;
+// Caches the dentry of a resolved component. Returns it with a reference, or
+// NULL if it could not be cached. Called with @parent's inode locked shared.
+struct dentry *networkfs_resolve_component(struct dentry *parent,
+                                           const char *name,
+                                           const struct entry_info *info) {
+  struct entry entry = {.entry_type = info->entry_type, .ino = info->ino};
+  strscpy(entry.name, name, sizeof(entry.name));
+  networkfs_prime_dentry(parent, &entry);
+
+  struct qstr qname = QSTR_INIT(name, strlen(name));
+  struct dentry *child = d_hash_and_lookup(parent, &qname);
+  if (IS_ERR_OR_NULL(child)) {
+    return NULL;
+  }
+  if (d_really_is_negative(child) || d_inode(child)->i_ino != info->ino) {
+    dput(child);
+    return NULL;
+  }
+  networkfs_set_entry(d_inode(child), info);
+  return child;
+}
+
+// Looks up leading components of @path below @dentry in one round trip and
+// caches their dentries, so a cold walk of a deep path costs a single call.
+// Servers without resolve get a lookup per component. @path is modified.
+int networkfs_resolve(struct dentry *dentry, char *path,
+                      unsigned int *resolved) {
+  struct networkfs_sb_info *info = dentry->d_sb->s_fs_info;
+  const char *names[RESOLVE_MAX_COMPONENTS];
+  size_t count = 0;
+  char *name;
+
+  // Server gets the path without empty components, as it is walked here
+  char *joined = kmalloc(strlen(path) + 1, GFP_KERNEL);
+  struct resolved_path *components =
+      kmalloc(sizeof(struct resolved_path), GFP_KERNEL);
+  if (joined == NULL || components == NULL) {
+    kfree(joined);
+    kfree(components);
+    return -ENOMEM;
+  }
+  joined[0] = '\0';
+
+  while ((name = strsep(&path, "/")) != NULL &&
+         count < RESOLVE_MAX_COMPONENTS) {
+    if (*name == '\0') {
+      continue;
+    }
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+        check_name_len(name)) {
+      kfree(joined);
+      kfree(components);
+      return -EINVAL;
+    }
+    if (count > 0) {
+      strcat(joined, "/");
+    }
+    strcat(joined, name);
+    names[count++] = name;
+  }
+
+  int64_t ret = -EOPNOTSUPP;
+  if (info->snapshot == NULL && !READ_ONCE(info->no_resolve) && count > 1) {
+    DECLARE_INO(d_inode(dentry)->i_ino);
+    ret = networkfs_transport_call(
+        info->transport, "resolve", (char *)components,
+        sizeof(struct resolved_path), 2, "parent", ino_ascii, "path", joined);
+    if (ret == -EHTTPBADCODE) {
+      WRITE_ONCE(info->no_resolve, true);
+    }
+  }
+
+  struct dentry *parent = dget(dentry);
+  *resolved = 0;
+  for (size_t i = 0; i < count && d_is_dir(parent); i++) {
+    struct entry_info component;
+    struct dentry *child = NULL;
+    if (ret == NETWORKFS_OK && i >= components->components_count) {
+      break;
+    }
+
+    // Primes the component the way a lookup under the lock would
+    inode_lock_shared(d_inode(parent));
+    if (ret == NETWORKFS_OK) {
+      component = components->components[i];
+      child = networkfs_resolve_component(parent, names[i], &component);
+    } else if (networkfs_lookup_entry(d_inode(parent), names[i],
+                                      &component) == NETWORKFS_OK) {
+      child = networkfs_resolve_component(parent, names[i], &component);
+    }
+    inode_unlock_shared(d_inode(parent));
+
+    if (child == NULL) {
+      break;
+    }
+    dput(parent);
+    parent = child;
+    ++*resolved;
+  }
+  dput(parent);
+
+  kfree(joined);
+  kfree(components);
   return 0;
 }
 
-void networkfs_kill_sb(struct super_block *sb) {
-  printk(KERN_INFO "%s\n", (char *)sb->s_fs_info);
-  kfree(sb->s_fs_info);
-  printk(KERN_INFO "networkfs: superblock is destroyed");
+long networkfs_dir_ioctl(struct file *filp, unsigned int cmd,
+                         unsigned long arg) {
+  struct networkfs_resolve_args args;
+
+  if (cmd != NETWORKFS_IOC_RESOLVE) {
+    return -ENOTTY;
+  }
+  if (copy_from_user(&args, (void __user *)arg, sizeof(args)) != 0) {
+    return -EFAULT;
+  }
+  if (args.path_length == 0 || args.path_length >= PATH_MAX) {
+    return -EINVAL;
+  }
+
+  char *path = memdup_user_nul(u64_to_user_ptr(args.path), args.path_length);
+  if (IS_ERR(path)) {
+    return PTR_ERR(path);
+  }
+  int error = networkfs_resolve(filp->f_path.dentry, path, &args.resolved);
+  kfree(path);
+
+  if (error == 0 && copy_to_user((void __user *)arg, &args, sizeof(args))) {
+    error = -EFAULT;
+  }
+  return error;
 }
 
-MODULE_LICENSE("GPL");
-MODULE_AUTHOR("Matson Artem");
-MODULE_VERSION("0.01");
+// Waits while foreground calls are in progress, so the prefetcher only uses
+// idle time. Returns false if prefetching has to stop.
+bool networkfs_prefetch_wait(struct networkfs_sb_info *info) {
+  struct networkfs_prefetcher *pf = info->prefetcher;
 
-int networkfs_init(void) {
-  int ret = register_filesystem(&networkfs_fs_type);
-  if (ret != 0) {
-    return ret;
+  while (true) {
+    if (READ_ONCE(pf->stopping) ||
+        time_before(jiffies,
+                    READ_ONCE(pf->pressure_time) + PREFETCH_PRESSURE_BACKOFF)) {
+      return false;
+    }
+    if (atomic_read(&info->transport->calls) <= atomic_read(&pf->listing)) {
+      return true;
+    }
+    schedule_timeout_uninterruptible(PREFETCH_BACKOFF);
   }
-  printk(KERN_INFO "Init fs\n");
-  return 0;
+}
+
+// Queues @dentry to be listed along with @depth - 1 levels below it. Every
+// directory is queued once in the lifetime of its inode.
+void networkfs_prefetch_queue(struct networkfs_sb_info *info,
+                              struct dentry *dentry, unsigned int depth) {
+  struct networkfs_prefetcher *pf = info->prefetcher;
+  struct inode *inode = d_inode(dentry);
+
+  if (pf == NULL || depth == 0 || READ_ONCE(pf->stopping) || inode == NULL ||
+      !S_ISDIR(inode->i_mode) ||
+      test_and_set_bit(NETWORKFS_I_PREFETCHED, &NETWORKFS_I(inode)->flags)) {
+    return;
+  }
+
+  struct networkfs_prefetch_item *item =
+      kmalloc(sizeof(struct networkfs_prefetch_item), GFP_KERNEL);
+  if (item == NULL) {
+    clear_bit(NETWORKFS_I_PREFETCHED, &NETWORKFS_I(inode)->flags);
+    return;
+  }
+  INIT_WORK(&item->work, networkfs_prefetch_work);
+  item->dentry = dget(dentry);
+  item->depth = depth;
+  atomic_inc(&pf->queued);
+  queue_work(pf->wq, &item->work);
+}
+
+// Primes dentries of a listed page and queues subdirectories
+void networkfs_prefetch_page(struct networkfs_sb_info *info,
+                             struct networkfs_prefetch_item *item,
+                             const struct entries *entries) {
+  for (size_t i = 0; i < entries->entries_count; i++) {
+    const struct entry *entry = &entries->entries[i];
+    networkfs_prime_dentry(item->dentry, entry);
+    if (entry->entry_type != DT_DIR || item->depth <= 1) {
+      continue;
+    }
+
+    struct qstr name = QSTR_INIT(entry->name, strlen(entry->name));
+    struct dentry *child = d_hash_and_lookup(item->dentry, &name);
+    if (!IS_ERR_OR_NULL(child)) {
+      networkfs_prefetch_queue(info, child, item->depth - 1);
+      dput(child);
+    }
+  }
+}
+
+// Lists a page of the directory and primes its dentries under the shared
+// lock of the directory, as iterate_shared does. A directory being modified
+// is skipped with -EBUSY rather than waited for.
+int networkfs_prefetch_list(struct networkfs_sb_info *info,
+                            struct networkfs_prefetch_item *item,
+                            struct networkfs_dir_cursor *dir, uint64_t cursor,
+                            loff_t page_pos) {
+  struct inode *inode = d_inode(item->dentry);
+  struct networkfs_prefetcher *pf = info->prefetcher;
+
+  if (!inode_trylock_shared(inode)) {
+    return -EBUSY;
+  }
+  atomic_inc(&pf->listing);
+  int error = networkfs_list_page(inode, dir, cursor, page_pos);
+  atomic_dec(&pf->listing);
+  if (error == 0) {
+    networkfs_prefetch_page(info, item, &dir->page.entries);
+  }
+  inode_unlock_shared(inode);
+  return error;
+}
+
+void networkfs_prefetch_work(struct work_struct *work) {
+  struct networkfs_prefetch_item *item =
+      container_of(work, struct networkfs_prefetch_item, work);
+  struct inode *inode = d_inode(item->dentry);
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+  struct networkfs_prefetcher *pf = info->prefetcher;
+  struct networkfs_dir_cursor *dir = NULL;
+
+  if (networkfs_prefetch_wait(info)) {
+    dir = kmem_cache_alloc(networkfs_dir_cachep, GFP_KERNEL);
+  }
+  if (dir != NULL) {
+    dir->index = NULL;
+    int error = networkfs_prefetch_list(info, item, dir, 0, 2);
+    if (error == -EBUSY) {
+      // Lets a later walk queue the directory again
+      clear_bit(NETWORKFS_I_PREFETCHED, &NETWORKFS_I(inode)->flags);
+    }
+
+    while (error == 0 && dir->page.next_cursor != 0 &&
+           networkfs_prefetch_wait(info)) {
+      error = networkfs_prefetch_list(
+          info, item, dir, dir->page.next_cursor,
+          dir->page_pos + dir->page.entries.entries_count);
+    }
+
+    networkfs_dir_index_free(dir->index);
+    kmem_cache_free(networkfs_dir_cachep, dir);
+  }
+
+  dput(item->dentry);
+  kfree(item);
+  atomic_dec(&pf->queued);
+}
+
+unsigned long networkfs_prefetch_count(struct shrinker *shrinker,
+                                       struct shrink_control *sc) {
+  struct networkfs_prefetcher *pf =
+      container_of(shrinker, struct networkfs_prefetcher, shrinker);
+  return atomic_read(&pf->queued);
+}
+
+// Items cannot be taken back from the workqueue, so reclaim only makes the
+// prefetcher drop them as they run
+unsigned long networkfs_prefetch_scan(struct shrinker *shrinker,
+                                      struct shrink_control *sc) {
+  struct networkfs_prefetcher *pf =
+      container_of(shrinker, struct networkfs_prefetcher, shrinker);
+  WRITE_ONCE(pf->pressure_time, jiffies);
+  return SHRINK_STOP;
+}
+
+int networkfs_prefetcher_start(struct super_block *sb, unsigned int depth) {
+  struct networkfs_sb_info *info = sb->s_fs_info;
+  struct networkfs_prefetcher *pf =
+      kzalloc(sizeof(struct networkfs_prefetcher), GFP_KERNEL);
+  if (pf == NULL) {
+    return -ENOMEM;
+  }
+
+  pf->wq = alloc_workqueue("networkfs-prefetch", WQ_UNBOUND,
+                           PREFETCH_CONCURRENCY);
+  if (pf->wq == NULL) {
+    kfree(pf);
+    return -ENOMEM;
+  }
+  pf->depth = depth;
+  pf->pressure_time = jiffies - PREFETCH_PRESSURE_BACKOFF;
+  pf->shrinker.count_objects = networkfs_prefetch_count;
+  pf->shrinker.scan_objects = networkfs_prefetch_scan;
+  pf->shrinker.seeks = DEFAULT_SEEKS;
+  int error = register_shrinker(&pf->shrinker, "networkfs-prefetch:%s",
+                                sb->s_id);
+  if (error != 0) {
+    destroy_workqueue(pf->wq);
+    kfree(pf);
+    return error;
+  }
+
+  info->prefetcher = pf;
+  networkfs_prefetch_queue(info, sb->s_root, depth);
+  return 0;
+}
+
+// Drops queued items, which hold dentries, before the superblock goes away.
+// Later walks of the unmount see no prefetcher and queue nothing.
+void networkfs_prefetcher_stop(struct networkfs_sb_info *info) {
+  struct networkfs_prefetcher *pf = info->prefetcher;
+
+  WRITE_ONCE(pf->stopping, true);
+  destroy_workqueue(pf->wq);
+  info->prefetcher = NULL;
+  unregister_shrinker(&pf->shrinker);
+  kfree(pf);
+}
+
+// Applies changes of @inode entries made since @index listing
+int64_t networkfs_index_apply_changes(struct inode *inode,
+                                      struct networkfs_dir_index *index,
+                                      struct entries_delta *delta) {
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+  char since_ascii[INO_ASCII_SIZE];
+  u64 since = index->change;
+  DECLARE_INO(inode->i_ino);
+
+  do {
+    snprintf(since_ascii, sizeof(since_ascii), "%llu", since);
+    int64_t ret = networkfs_transport_call(
+        info->transport, "list_changes", (char *)delta,
+        sizeof(struct entries_delta), 2, "inode", ino_ascii, "since",
+        since_ascii);
+    if (ret == -EHTTPBADCODE) {
+      WRITE_ONCE(info->no_list_changes, true);
+    }
+    if (ret != 0) {
+      return ret;
+    }
+    if (delta->changes_count > ARRAY_SIZE(delta->changes) ||
+        (delta->next_since != 0 && delta->next_since <= since)) {
+      return -EIO;
+    }
+
+    for (size_t i = 0; i < delta->changes_count; i++) {
+      struct entry *entry = &delta->changes[i].entry;
+      entry->name[sizeof(entry->name) - 1] = '\0';
+      if (delta->changes[i].removed) {
+        networkfs_dir_index_remove(index, entry->name);
+      } else if (networkfs_dir_index_insert(index, entry) != 0) {
+        return -ENOMEM;
+      }
+    }
+
+    index->change = delta->change;
+    since = delta->next_since;
+  } while (since != 0);
+
+  return 0;
+}
+
+// Brings the index of @inode listed at change attribute @since up to date.
+// Only the entries added or removed since then are fetched. When the server
+// has no change log reaching that far, the index is dropped and lookups go
+// to the server: listing the whole directory is left to the next readdir
+// rather than done on the path of a lookup.
+void networkfs_index_sync(struct inode *inode, u64 since) {
+  struct networkfs_inode *dir = NETWORKFS_I(inode);
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+  struct networkfs_dir_index *index;
+  unsigned long start = jiffies;
+  int64_t ret = -EOPNOTSUPP;
+
+  // Lookups go to the server while the index is detached
+  spin_lock(&dir->index_lock);
+  index = dir->index;
+  if (index == NULL || index->change != since) {
+    spin_unlock(&dir->index_lock);
+    return;
+  }
+  dir->index = NULL;
+  spin_unlock(&dir->index_lock);
+
+  if (!READ_ONCE(info->no_list_changes)) {
+    struct entries_delta *delta =
+        kmalloc(sizeof(struct entries_delta), GFP_KERNEL);
+    ret = delta == NULL
+              ? -ENOMEM
+              : networkfs_index_apply_changes(inode, index, delta);
+    kfree(delta);
+  }
+
+  if (ret == 0) {
+    index->time = start;
+    networkfs_index_publish(inode, index);
+  } else {
+    networkfs_dir_index_free(index);
+  }
+}
+
+bool networkfs_snapshot_emit(void *data, const char *name,
+                             const struct entry_info *info) {
+  struct dir_context *ctx = data;
+
+  if (!dir_emit(ctx, name, strlen(name), info->ino, info->entry_type)) {
+    return false;
+  }
+  ++ctx->pos;
+  return true;
+}
+
+// Lists a directory of the snapshot, positions past dots count its entries
+int networkfs_snapshot_iterate(struct file *filp, struct dir_context *ctx) {
+  struct inode *inode = file_inode(filp);
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+
+  struct networkfs_dir_index *index =
+      networkfs_snapshot_dir(info->snapshot, inode->i_ino);
+  if (index == NULL) {
+    return -ENOTDIR;
+  }
+  networkfs_dir_index_walk(index, ctx->pos - 2, networkfs_snapshot_emit, ctx);
+  return 0;
+}
+
+// Streams the listing page by page. The page around the position is kept in
+// file->private_data, so getdents continuations do not refetch it.
+int networkfs_iterate(struct file *filp, struct dir_context *ctx) {
+  struct inode *inode = file_inode(filp);
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+  struct networkfs_dir_cursor *dir = filp->private_data;
+  int error;
+
+  if (!dir_emit_dots(filp, ctx)) {
+    return 0;
+  }
+  if (info->snapshot != NULL) {
+    return networkfs_snapshot_iterate(filp, ctx);
+  }
+
+  if (dir == NULL) {
+    dir = kmem_cache_alloc(networkfs_dir_cachep, GFP_KERNEL);
+    if (dir == NULL) {
+      return -ENOMEM;
+    }
+    dir->valid = false;
+    dir->index = NULL;
+    filp->private_data = dir;
+    if (info->prefetcher != NULL) {
+      networkfs_prefetch_queue(info, filp->f_path.dentry,
+                               info->prefetcher->depth);
+    }
+  }
+
+  if (!dir->valid || ctx->pos < dir->page_pos) {
+    // Cursors only go forward, so start over
+    error = networkfs_list_page(inode, dir, 0, 2);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  bool prime = info->rdirplus && READ_ONCE(NETWORKFS_I(inode)->readdir_plus);
+  WRITE_ONCE(NETWORKFS_I(inode)->readdir_time, jiffies);
+
+  while (true) {
+    struct entries *entries = &dir->page.entries;
+    while (ctx->pos < dir->page_pos + entries->entries_count) {
+      struct entry *entry = &entries->entries[ctx->pos - dir->page_pos];
+      if (prime) {
+        networkfs_prime_dentry(filp->f_path.dentry, entry);
+      }
+      if (!dir_emit(ctx, entry->name, strlen(entry->name), entry->ino,
+                    entry->entry_type)) {
+        return 0;
+      }
+      ++ctx->pos;
+    }
+
+    if (dir->page.next_cursor == 0) {
+      return 0;
+    }
+    error = networkfs_list_page(inode, dir, dir->page.next_cursor,
+                                dir->page_pos + entries->entries_count);
+    if (error != 0) {
+      return error;
+    }
+  }
+}
+
+// Rewinding fetches the listing again, so the next read sees current contents.
+// Positions count entries, so they are not bounded by the file size limit.
+loff_t networkfs_dir_llseek(struct file *filp, loff_t offset, int whence) {
+  struct networkfs_dir_cursor *dir = filp->private_data;
+  loff_t ret = generic_file_llseek_size(filp, offset, whence, LLONG_MAX,
+                                        i_size_read(file_inode(filp)));
+
+  if (ret == 0 && dir != NULL) {
+    dir->valid = false;
+  }
+
+  return ret;
+}
+
+int networkfs_dir_release(struct inode *inode, struct file *filp) {
+  struct networkfs_dir_cursor *dir = filp->private_data;
+
+  if (dir != NULL) {
+    networkfs_dir_index_free(dir->index);
+    kmem_cache_free(networkfs_dir_cachep, dir);
+  }
+  return 0;
+}
+
+void networkfs_set_etag(struct inode *inode, const char *etag) {
+  spin_lock(&inode->i_lock);
+  strscpy(NETWORKFS_I(inode)->etag, etag, NETWORKFS_ETAG_SIZE);
+  spin_unlock(&inode->i_lock);
+}
+
+// Fetches the whole content of @inode, which updates its size. Only
+// revalidating fetches are conditional: they skip content that still matches
+// @if_none_match, which may be NULL, and keep the entity tag of what they
+// fetched. Binary protocol carries no entity tags, so such fetches go over
+// HTTP while plain ones do not.
+int64_t networkfs_fetch_content(struct inode *inode, struct content *content,
+                                bool revalidate, const char *if_none_match) {
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+  struct networkfs_call call;
+  DECLARE_INO(inode->i_ino);
+
+  networkfs_call_init(&call, "read", (char *)content, sizeof(struct content),
+                      1, "inode", ino_ascii);
+  call.conditional = revalidate;
+  call.if_none_match = if_none_match;
+  int64_t ret = networkfs_call_run(info->transport, &call);
+  if (ret == NETWORKFS_OK) {
+    if (revalidate) {
+      networkfs_set_etag(inode, call.etag);
+    }
+    networkfs_set_size(inode, content->content_length);
+  }
+  return ret;
+}
+
+// Copies the part of @content covered by @folio and zeroes the rest
+void networkfs_fill_folio(struct folio *folio, const struct content *content) {
+  size_t length = min_t(uint64_t, content->content_length, CONTENT_MAX_SIZE);
+  loff_t pos = folio_pos(folio);
+  size_t copied =
+      pos < length ? min_t(size_t, folio_size(folio), length - pos) : 0;
+
+  // Large folios are not enabled, so the folio is a single page
+  char *addr = kmap_local_folio(folio, 0);
+  memcpy(addr, content->content + pos, copied);
+  memset(addr + copied, 0, folio_size(folio) - copied);
+  kunmap_local(addr);
+
+  flush_dcache_folio(folio);
+  folio_mark_uptodate(folio);
+}
+
+// Puts freshly fetched content into the page cache, so reads after open are
+// served without a round trip
+void networkfs_cache_content(struct inode *inode,
+                             const struct content *content) {
+  size_t length = min_t(uint64_t, content->content_length, CONTENT_MAX_SIZE);
+
+  for (pgoff_t index = 0; index < DIV_ROUND_UP(length, PAGE_SIZE); index++) {
+    struct folio *folio = __filemap_get_folio(
+        inode->i_mapping, index, FGP_LOCK | FGP_CREAT,
+        mapping_gfp_mask(inode->i_mapping));
+    if (IS_ERR(folio)) {
+      return;
+    }
+    if (!folio_test_uptodate(folio)) {
+      networkfs_fill_folio(folio, content);
+    }
+    folio_unlock(folio);
+    folio_put(folio);
+  }
+}
+
+// Makes sure the page cache holds current content of @inode and i_size is
+// its length, in one round trip. While the entity tag matches, the round
+// trip carries no payload; otherwise cached pages are replaced with the
+// fetched content.
+void networkfs_revalidate_content(struct inode *inode) {
+  char etag[NETWORKFS_ETAG_SIZE] = "";
+  bool cached = READ_ONCE(inode->i_mapping->nrpages) > 0;
+
+  if (mapping_tagged(inode->i_mapping, PAGECACHE_TAG_DIRTY) ||
+      mapping_tagged(inode->i_mapping, PAGECACHE_TAG_WRITEBACK)) {
+    // Local writes are newer than anything the server has
+    return;
+  }
+  if (cached) {
+    spin_lock(&inode->i_lock);
+    strscpy(etag, NETWORKFS_I(inode)->etag, NETWORKFS_ETAG_SIZE);
+    spin_unlock(&inode->i_lock);
+  }
+
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+  int64_t ret = -ENOMEM;
+  struct content *content = mempool_alloc(info->contents, GFP_KERNEL);
+  if (content != NULL) {
+    ret = networkfs_fetch_content(inode, content, true,
+                                  etag[0] != '\0' ? etag : NULL);
+  }
+
+  if (ret != NETWORKFS_ENOTMODIFIED) {
+    // Pages are not trusted when the server could not be asked. Pages that
+    // could not be dropped would be mixed with the fetched content, so it is
+    // not cached, and the next open tries again without the entity tag.
+    if (cached && invalidate_inode_pages2(inode->i_mapping) != 0) {
+      ret = -EBUSY;
+    }
+    if (ret == NETWORKFS_OK) {
+      networkfs_cache_content(inode, content);
+    } else {
+      networkfs_set_etag(inode, "");
+    }
+  }
+  if (content != NULL) {
+    mempool_free(content, info->contents);
+  }
+}
+
+int networkfs_file_open(struct inode *inode, struct file *filp) {
+  // Content about to be truncated is not worth fetching, and writers only
+  // need the pages already cached checked
+  if (!(filp->f_flags & O_TRUNC) &&
+      ((filp->f_mode & FMODE_READ) ||
+       READ_ONCE(inode->i_mapping->nrpages) > 0)) {
+    networkfs_revalidate_content(inode);
+  }
+  return generic_file_open(inode, filp);
+}
+
+int networkfs_read_folio(struct file *file, struct folio *folio) {
+  struct inode *inode = folio->mapping->host;
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+  int error = -EIO;
+
+  struct content *content = mempool_alloc(info->contents, GFP_KERNEL);
+  if (content == NULL) {
+    error = -ENOMEM;
+  } else {
+    if (networkfs_fetch_content(inode, content, false, NULL) ==
+        NETWORKFS_OK) {
+      networkfs_fill_folio(folio, content);
+      error = 0;
+    }
+    mempool_free(content, info->contents);
+  }
+
+  folio_unlock(folio);
+  return error;
+}
+
+// Whole content comes in one call, so every folio of the window is filled
+// from it. Folios left unfilled on error are released by the caller.
+void networkfs_readahead(struct readahead_control *rac) {
+  struct inode *inode = rac->mapping->host;
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+  struct folio *folio;
+
+  struct content *content = mempool_alloc(info->contents, GFP_KERNEL);
+  if (content == NULL) {
+    return;
+  }
+  if (networkfs_fetch_content(inode, content, false, NULL) == NETWORKFS_OK) {
+    while ((folio = readahead_folio(rac)) != NULL) {
+      networkfs_fill_folio(folio, content);
+      folio_unlock(folio);
+    }
+  }
+  mempool_free(content, info->contents);
+}
+
+// Replaces content of @inode on the server with the string @content
+int networkfs_write_content(struct inode *inode, const char *content) {
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+  struct networkfs_call call;
+  DECLARE_INO(inode->i_ino);
+
+  networkfs_call_init(&call, "write", NULL, 0, 2, "inode", ino_ascii,
+                      "content", content);
+  int64_t ret = networkfs_call_run(info->transport, &call);
+  // Cached pages hold the new content, whose entity tag the next open learns
+  networkfs_set_etag(inode, "");
+
+  switch (ret) {
+    case NETWORKFS_OK:
+      return 0;
+    case NETWORKFS_EFBIG:
+      return -EFBIG;
+    default:
+      return -EIO;
+  }
+}
+
+// Copies the first @size bytes of @folio into @content as a string
+void networkfs_copy_folio(struct folio *folio, char *content, size_t size) {
+  char *addr = kmap_local_folio(folio, 0);
+  memcpy(content, addr, size);
+  kunmap_local(addr);
+  content[size] = '\0';
+}
+
+int networkfs_write_begin(struct file *file, struct address_space *mapping,
+                          loff_t pos, unsigned int len, struct page **pagep,
+                          void **fsdata) {
+  struct inode *inode = mapping->host;
+  struct folio *folio;
+
+  if (pos >= CONTENT_MAX_SIZE) {
+    return -EFBIG;
+  }
+
+again:
+  folio = __filemap_get_folio(mapping, pos >> PAGE_SHIFT,
+                              FGP_LOCK | FGP_WRITE | FGP_CREAT | FGP_STABLE,
+                              mapping_gfp_mask(mapping));
+  if (IS_ERR(folio)) {
+    return PTR_ERR(folio);
+  }
+
+  if (!folio_test_uptodate(folio)) {
+    if (folio_pos(folio) >= i_size_read(inode)) {
+      // Nothing to keep past the end of the file
+      folio_zero_range(folio, 0, folio_size(folio));
+      folio_mark_uptodate(folio);
+    } else {
+      // Write may cover only part of the content, so the rest is fetched
+      int error = networkfs_read_folio(file, folio);
+      if (error != 0) {
+        folio_put(folio);
+        return error;
+      }
+      folio_lock(folio);
+      if (folio->mapping != mapping || !folio_test_uptodate(folio)) {
+        folio_unlock(folio);
+        folio_put(folio);
+        goto again;
+      }
+    }
+  }
+
+  *pagep = &folio->page;
+  return 0;
+}
+
+int networkfs_write_end(struct file *file, struct address_space *mapping,
+                        loff_t pos, unsigned int len, unsigned int copied,
+                        struct page *page, void *fsdata) {
+  struct folio *folio = page_folio(page);
+  struct inode *inode = mapping->host;
+
+  if (pos + copied > CONTENT_MAX_SIZE) {
+    // Longer writes are cut short, the rest of the page stays beyond the end
+    copied = CONTENT_MAX_SIZE - pos;
+    folio_zero_segment(folio, CONTENT_MAX_SIZE, folio_size(folio));
+  }
+  if (pos + copied > i_size_read(inode)) {
+    networkfs_set_size(inode, pos + copied);
+  }
+  folio_mark_dirty(folio);
+  folio_unlock(folio);
+  folio_put(folio);
+
+  return copied;
+}
+
+// Content gathered by writepages
+struct networkfs_writeback {
+  char content[CONTENT_MAX_SIZE + 1];
+  struct folio *folio;  // under writeback until the content is written
+};
+
+// Element of the per-mount pool of buffers for content in transit
+union networkfs_content_buffer {
+  struct content content;                // fetched content
+  struct networkfs_writeback writeback;  // content written back
+  char string[CONTENT_MAX_SIZE + 1];     // content written by truncate
+};
+
+int networkfs_writeback_folio(struct page *page, struct writeback_control *wbc,
+                              void *data) {
+  struct networkfs_writeback *writeback = data;
+  struct folio *folio = page_folio(page);
+  loff_t size = i_size_read(folio->mapping->host);
+
+  if (folio->index != 0) {
+    // Beyond any content the server can store
+    folio_unlock(folio);
+    return 0;
+  }
+
+  networkfs_copy_folio(folio, writeback->content,
+                       min_t(loff_t, size, CONTENT_MAX_SIZE));
+  folio_start_writeback(folio);
+  folio_unlock(folio);
+  folio_get(folio);
+  writeback->folio = folio;
+  return 0;
+}
+
+// Server replaces content as a whole and it fits into one page, so every
+// write that dirtied the page since the last flush goes out in one call
+int networkfs_writepages(struct address_space *mapping,
+                         struct writeback_control *wbc) {
+  BUILD_BUG_ON(CONTENT_MAX_SIZE > PAGE_SIZE);
+  struct networkfs_sb_info *info = mapping->host->i_sb->s_fs_info;
+
+  struct networkfs_writeback *writeback =
+      mempool_alloc(info->contents, GFP_NOFS);
+  if (writeback == NULL) {
+    return -ENOMEM;
+  }
+  writeback->folio = NULL;
+
+  int error =
+      write_cache_pages(mapping, wbc, networkfs_writeback_folio, writeback);
+  if (writeback->folio != NULL) {
+    int ret = networkfs_write_content(mapping->host, writeback->content);
+    if (ret != 0) {
+      mapping_set_error(mapping, ret);
+      error = error != 0 ? error : ret;
+    }
+    folio_end_writeback(writeback->folio);
+    folio_put(writeback->folio);
+  }
+
+  mempool_free(writeback, info->contents);
+  return error;
+}
+
+// Writes are synchronous calls, so written back data is on the server
+int networkfs_fsync(struct file *file, loff_t start, loff_t end,
+                    int datasync) {
+  return file_write_and_wait_range(file, start, end);
+}
+
+int networkfs_flush(struct file *file, fl_owner_t id) {
+  if (!(file->f_mode & FMODE_WRITE)) {
+    return 0;
+  }
+  return filemap_write_and_wait(file->f_mapping);
+}
+
+// Writes the truncated content at once, together with writes still in the
+// page cache. Local size and pages are cut only once the server has it.
+// Content is a string, so zeroes appended by extending the file do not reach
+// the server.
+int networkfs_truncate(struct inode *inode, loff_t size) {
+  struct networkfs_sb_info *info = inode->i_sb->s_fs_info;
+  char *content = mempool_alloc(info->contents, GFP_KERNEL);
+  if (content == NULL) {
+    return -ENOMEM;
+  }
+
+  content[0] = '\0';
+  if (size > 0) {
+    struct folio *folio = read_mapping_folio(inode->i_mapping, 0, NULL);
+    if (IS_ERR(folio)) {
+      mempool_free(content, info->contents);
+      return PTR_ERR(folio);
+    }
+    folio_lock(folio);
+    networkfs_copy_folio(folio, content,
+                         min_t(loff_t, size, i_size_read(inode)));
+    folio_unlock(folio);
+    folio_put(folio);
+  }
+
+  int error = networkfs_write_content(inode, content);
+  if (error == 0) {
+    truncate_setsize(inode, size);
+  }
+  mempool_free(content, info->contents);
+  return error;
+}
+
+int networkfs_setattr(struct user_namespace *user_ns, struct dentry *dentry,
+                      struct iattr *attr) {
+  struct inode *inode = d_inode(dentry);
+
+  int error = setattr_prepare(user_ns, dentry, attr);
+  if (error != 0) {
+    return error;
+  }
+  if ((attr->ia_valid & ATTR_SIZE) && S_ISREG(inode->i_mode)) {
+    if (attr->ia_size > CONTENT_MAX_SIZE) {
+      return -EFBIG;
+    }
+    error = networkfs_truncate(inode, attr->ia_size);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  setattr_copy(user_ns, inode, attr);
+  return 0;
+}
+
+// Drops the dentry of a removed entry, even if it is still fresh
+void networkfs_forget_entry(struct inode *dir, const char *name) {
+  struct dentry *parent = d_find_alias(dir);
+  if (parent == NULL) {
+    return;
+  }
+
+  struct qstr qname = QSTR_INIT(name, strnlen(name, MAX_TITLE_LEN));
+  struct dentry *child = d_hash_and_lookup(parent, &qname);
+  if (!IS_ERR_OR_NULL(child)) {
+    d_invalidate(child);
+    dput(child);
+  }
+  dput(parent);
+}
+
+// Applies an event pushed by the server. Only cached inodes are affected.
+void networkfs_watch_apply(struct super_block *sb,
+                           const struct watch_event *event) {
+  struct inode *inode = ilookup(sb, event->ino);
+  if (inode == NULL) {
+    return;
+  }
+
+  if (S_ISDIR(inode->i_mode)) {
+    networkfs_dir_changed(inode);
+    if (event->kind == NETWORKFS_WATCH_REMOVED) {
+      networkfs_forget_entry(inode, event->entry.name);
+    }
+  } else {
+    networkfs_set_etag(inode, "");
+    invalidate_inode_pages2(inode->i_mapping);
+  }
+  iput(inode);
+}
+
+// Distrusts everything cached so far, as if events about all of it were lost.
+// Dentries, change attributes and indexes check the time, indexes and
+// negative dentries are dropped at once, and clean pages of files are
+// evicted, so the next read fetches their content.
+void networkfs_watch_lost(struct super_block *sb) {
+  struct networkfs_sb_info *info = sb->s_fs_info;
+  struct inode *inode, *held, *previous = NULL;
+
+  WRITE_ONCE(info->trusted_since, jiffies + 1);
+
+  spin_lock(&sb->s_inode_list_lock);
+  list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+    held = igrab(inode);
+    if (held == NULL) {
+      continue;
+    }
+    // Held inode stays on the list, so the walk can go on from it
+    spin_unlock(&sb->s_inode_list_lock);
+
+    if (S_ISDIR(held->i_mode)) {
+      networkfs_dir_changed(held);
+    } else {
+      invalidate_mapping_pages(held->i_mapping, 0, -1);
+    }
+    iput(previous);
+    previous = held;
+
+    cond_resched();
+    spin_lock(&sb->s_inode_list_lock);
+  }
+  spin_unlock(&sb->s_inode_list_lock);
+  iput(previous);
+
+  shrink_dcache_sb(sb);
+}
+
+// Sleeps unless the watcher is being stopped
+void networkfs_watch_sleep(long timeout) {
+  set_current_state(TASK_INTERRUPTIBLE);
+  if (!kthread_should_stop()) {
+    schedule_timeout(timeout);
+  }
+  __set_current_state(TASK_RUNNING);
+}
+
+// Keeps a watch call open against the server and applies events it pushes,
+// so caches can live long and still see changes made by other clients.
+int networkfs_watcher(void *data) {
+  struct super_block *sb = data;
+  struct networkfs_sb_info *info = sb->s_fs_info;
+  struct networkfs_call call;
+  char since_ascii[INO_ASCII_SIZE];
+  u64 since = 0;
+
+  struct watch_events *events =
+      kmalloc(sizeof(struct watch_events), GFP_KERNEL);
+
+  while (!kthread_should_stop()) {
+    if (events == NULL) {
+      networkfs_watch_sleep(MAX_SCHEDULE_TIMEOUT);
+      continue;
+    }
+
+    snprintf(since_ascii, sizeof(since_ascii), "%llu", since);
+    networkfs_call_init(&call, "watch", (char *)events,
+                        sizeof(struct watch_events), 2, "since", since_ascii,
+                        "timeout", WATCH_TIMEOUT);
+    int64_t ret = networkfs_transport_watch(info->transport, &call);
+
+    if (ret == NETWORKFS_OK) {
+      size_t count = min_t(size_t, events->events_count,
+                           ARRAY_SIZE(events->events));
+      for (size_t i = 0; i < count; i++) {
+        networkfs_watch_apply(sb, &events->events[i]);
+      }
+      since = events->next_since;
+    } else if (ret == NETWORKFS_ETRUNCATED) {
+      // Events were lost, so nothing cached can be trusted
+      networkfs_watch_lost(sb);
+      since = 0;
+    } else if (ret == -EOPNOTSUPP || ret == -EHTTPBADCODE) {
+      pr_info("networkfs: server does not support watch\n");
+      networkfs_watch_sleep(MAX_SCHEDULE_TIMEOUT);
+    } else if (ret != -EINTR) {
+      networkfs_watch_sleep(WATCH_RETRY_DELAY);
+    }
+  }
+
+  kfree(events);
+  return 0;
+}
+
+// Returns the in-core inode for remote inode @i_ino, so that all names of one
+// remote object share it. Fresh inodes are initialized with @mode.
+struct inode *networkfs_get_inode(struct super_block *sb,
+                                  const struct inode *parent, umode_t mode,
+                                  ino_t i_ino) {
+  struct inode *inode = iget_locked(sb, i_ino);
+
+  if (inode != NULL && !(inode->i_state & I_NEW) &&
+      inode_wrong_type(inode, mode)) {
+    // Server reused the number for an object of another type
+    remove_inode_hash(inode);
+    iput(inode);
+    inode = iget_locked(sb, i_ino);
+  }
+  if (inode == NULL || !(inode->i_state & I_NEW)) {
+    return inode;
+  }
+
+  inode->i_op = &networkfs_inode_ops;
+  inode->i_fop = S_ISDIR(mode) ? &networkfs_dir_ops : &networkfs_file_ops;
+  if (S_ISREG(mode)) {
+    inode->i_mapping->a_ops = &networkfs_aops;
+  }
+  inode_init_owner(&init_user_ns, inode, parent, mode);
+  unlock_new_inode(inode);
+
+  return inode;
+}
+
+struct inode *networkfs_alloc_inode(struct super_block *sb) {
+  struct networkfs_inode *ni =
+      alloc_inode_sb(sb, networkfs_inode_cachep, GFP_KERNEL);
+  if (ni == NULL) {
+    return NULL;
+  }
+  ni->generation = 0;
+  ni->readdir_time = jiffies - READDIR_PLUS_WINDOW;
+  ni->readdir_plus = false;
+  spin_lock_init(&ni->index_lock);
+  ni->index = NULL;
+  ni->index_epoch = 0;
+  ni->change = 0;
+  ni->etag[0] = '\0';
+  ni->flags = 0;
+  return &ni->vfs_inode;
+}
+
+void networkfs_destroy_inode(struct inode *inode) {
+  networkfs_dir_index_free(NETWORKFS_I(inode)->index);
+}
+
+void networkfs_free_inode(struct inode *inode) {
+  kmem_cache_free(networkfs_inode_cachep, NETWORKFS_I(inode));
+}
+
+int networkfs_show_stats(struct seq_file *m, struct dentry *root) {
+  struct networkfs_sb_info *info = root->d_sb->s_fs_info;
+
+  seq_printf(m, "\n\tsingleflight: calls %lld coalesced %lld\n",
+             percpu_counter_sum(&info->singleflight.calls),
+             percpu_counter_sum(&info->singleflight.coalesced));
+  if (info->prefetcher != NULL) {
+    seq_printf(m, "\tprefetch: queued %d\n",
+               atomic_read(&info->prefetcher->queued));
+  }
+  return 0;
+}
+
+void networkfs_inode_init_once(void *data) {
+  struct networkfs_inode *ni = data;
+  inode_init_once(&ni->vfs_inode);
+}
+
+int networkfs_fill_super(struct super_block *sb, struct fs_context *fc) {
+  struct networkfs_mount_config *config = fc->fs_private;
+  struct networkfs_sb_info *info =
+      kzalloc(sizeof(struct networkfs_sb_info), GFP_KERNEL);
+  if (info == NULL) {
+    return -ENOMEM;
+  }
+  sb->s_fs_info = info;
+  sb->s_op = &networkfs_super_ops;
+  sb->s_d_op = &networkfs_dentry_ops;
+  info->lookup_ttl = msecs_to_jiffies(config->lookup_ttl);
+  info->trusted_since = jiffies;
+  info->negative_ttl = msecs_to_jiffies(config->negative_ttl);
+  info->rdirplus = config->rdirplus;
+  info->contents =
+      mempool_create_slab_pool(MIN_CONTENT_BUFFERS, networkfs_content_cachep);
+  if (info->contents == NULL) {
+    return -ENOMEM;
+  }
+
+  if (config->transport.type == NETWORKFS_TRANSPORT_HTTP &&
+      fc->source == NULL) {
+    return invalf(fc, "networkfs: token is required");
+  }
+  config->transport.token = fc->source;
+
+  info->transport = networkfs_transport_create(&config->transport);
+  if (IS_ERR(info->transport)) {
+    int ret = PTR_ERR(info->transport);
+    info->transport = NULL;
+    return ret;
+  }
+  int error = networkfs_compound_init(&info->compound, info->transport);
+  if (error != 0) {
+    return error;
+  }
+  error = networkfs_singleflight_init(&info->singleflight);
+  if (error != 0) {
+    return error;
+  }
+  // Anonymous superblocks share a device that never writes back
+  error = super_setup_bdi(sb);
+  if (error != 0) {
+    return error;
+  }
+
+  if (config->snapshot) {
+    // Writes would not reach the snapshot, so the mount is read-only
+    sb->s_flags |= SB_RDONLY;
+    info->snapshot = networkfs_snapshot_load(info->transport, 1000);
+    if (IS_ERR(info->snapshot)) {
+      int ret = PTR_ERR(info->snapshot);
+      info->snapshot = NULL;
+      errorf(fc, "networkfs: unable to fetch tree snapshot: %d", ret);
+      return ret;
+    }
+  }
+
+  struct inode *inode =
+      networkfs_get_inode(sb, NULL, S_IFDIR | S_IRWXUGO, 1000);
+  sb->s_root = d_make_root(inode);
+
+  if (sb->s_root == NULL) {
+    return -ENOMEM;
+  }
+
+  if (config->prefetch_depth > 0 && info->snapshot == NULL) {
+    error = networkfs_prefetcher_start(sb, config->prefetch_depth);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  if (config->watch) {
+    struct task_struct *watcher =
+        kthread_run(networkfs_watcher, sb, "networkfs-watch");
+    if (IS_ERR(watcher)) {
+      return PTR_ERR(watcher);
+    }
+    info->watcher = watcher;
+  }
+
+  return 0;
+}
+
+int networkfs_get_tree(struct fs_context *fc) {
+  int ret = get_tree_nodev(fc, &networkfs_fill_super);
+
+  if (ret != 0) {
+    printk(KERN_ERR "networkfs: unable to mount: error code %d", ret);
+  }
+
+  return ret;
+}
+
+int networkfs_parse_param(struct fs_context *fc, struct fs_parameter *param) {
+  struct networkfs_mount_config *config = fc->fs_private;
+  struct fs_parse_result result;
+
+  int opt = fs_parse(fc, networkfs_fs_parameters, param, &result);
+  if (opt < 0) {
+    return opt;
+  }
+
+  switch (opt) {
+    case Opt_transport:
+      config->transport.type = result.uint_32;
+      break;
+    case Opt_server:
+      if (in4_pton(param->string, -1,
+                   (u8 *)&config->transport.addr.sin_addr.s_addr, -1,
+                   NULL) == 0) {
+        return invalf(fc, "networkfs: bad server address %s", param->string);
+      }
+      break;
+    case Opt_port:
+      if (result.uint_32 == 0 || result.uint_32 > U16_MAX) {
+        return invalf(fc, "networkfs: bad server port %u", result.uint_32);
+      }
+      config->transport.addr.sin_port = htons(result.uint_32);
+      break;
+    case Opt_lookup_ttl:
+    case Opt_negative_ttl:
+      if (result.uint_32 > UINT_MAX / MSEC_PER_SEC) {
+        return invalf(fc, "networkfs: %s is too long", param->key);
+      }
+      if (opt == Opt_lookup_ttl) {
+        config->lookup_ttl = result.uint_32 * MSEC_PER_SEC;
+      } else {
+        config->negative_ttl = result.uint_32 * MSEC_PER_SEC;
+      }
+      break;
+    case Opt_lookup_ttl_ms:
+      config->lookup_ttl = result.uint_32;
+      break;
+    case Opt_negative_ttl_ms:
+      config->negative_ttl = result.uint_32;
+      break;
+    case Opt_rdirplus:
+      config->rdirplus = true;
+      break;
+    case Opt_watch:
+      config->watch = true;
+      break;
+    case Opt_snapshot:
+      config->snapshot = true;
+      break;
+    case Opt_prefetch_depth:
+      config->prefetch_depth = result.uint_32;
+      break;
+  }
+
+  return 0;
+}
+
+int networkfs_reconfigure(struct fs_context *fc) {
+  struct networkfs_sb_info *info = fc->root->d_sb->s_fs_info;
+
+  if (info->snapshot != NULL && !(fc->sb_flags & SB_RDONLY)) {
+    return invalf(fc, "networkfs: snapshot mounts are read-only");
+  }
+  return 0;
+}
+
+int networkfs_init_fs_context(struct fs_context *fc) {
+  struct networkfs_mount_config *config =
+      kzalloc(sizeof(struct networkfs_mount_config), GFP_KERNEL);
+  if (config == NULL) {
+    return -ENOMEM;
+  }
+
+  config->transport.type = NETWORKFS_TRANSPORT_HTTP;
+  config->transport.addr.sin_family = AF_INET;
+  config->transport.addr.sin_addr.s_addr = in_aton(DEFAULT_SERVER_IP);
+  config->transport.addr.sin_port = htons(DEFAULT_SERVER_PORT);
+  config->lookup_ttl = DEFAULT_LOOKUP_TTL;
+  config->negative_ttl = DEFAULT_NEGATIVE_TTL;
+
+  fc->fs_private = config;
+  fc->ops = &networkfs_context_ops;
+  return 0;
+}
+
+void networkfs_free_fs_context(struct fs_context *fc) {
+  kfree(fc->fs_private);
+}
+
+void networkfs_kill_sb(struct super_block *sb) {
+  struct networkfs_sb_info *info = sb->s_fs_info;
+  if (info != NULL && info->watcher != NULL) {
+    networkfs_transport_interrupt(info->transport);
+    kthread_stop(info->watcher);
+  }
+  if (info != NULL && info->prefetcher != NULL) {
+    networkfs_prefetcher_stop(info);
+  }
+  kill_anon_super(sb);
+  if (info != NULL) {
+    if (info->snapshot != NULL) {
+      networkfs_snapshot_free(info->snapshot);
+    }
+    if (info->transport != NULL) {
+      networkfs_transport_teardown(info->transport);
+    }
+    networkfs_singleflight_destroy(&info->singleflight);
+    networkfs_compound_destroy(&info->compound);
+    mempool_destroy(info->contents);
+    kfree(info);
+  }
+  printk(KERN_INFO "networkfs: superblock is destroyed");
+}
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Matson Artem");
+MODULE_VERSION("0.01");
+
+int networkfs_init(void) {
+  int ret = -ENOMEM;
+
+  networkfs_dir_cachep = kmem_cache_create(
+      "networkfs_dir_cursor", sizeof(struct networkfs_dir_cursor), 0, 0, NULL);
+  if (networkfs_dir_cachep == NULL) {
+    return -ENOMEM;
+  }
+
+  networkfs_inode_cachep = kmem_cache_create(
+      "networkfs_inode", sizeof(struct networkfs_inode), 0,
+      SLAB_RECLAIM_ACCOUNT | SLAB_ACCOUNT, networkfs_inode_init_once);
+  if (networkfs_inode_cachep == NULL) {
+    goto destroy_dir;
+  }
+
+  networkfs_content_cachep =
+      kmem_cache_create("networkfs_content",
+                        sizeof(union networkfs_content_buffer), 0, 0, NULL);
+  if (networkfs_content_cachep == NULL) {
+    goto destroy_inode;
+  }
+
+  ret = networkfs_compound_cache_init();
+  if (ret != 0) {
+    goto destroy_content;
+  }
+
+  ret = networkfs_transport_init();
+  if (ret != 0) {
+    goto destroy_compound;
+  }
+
+  ret = register_filesystem(&networkfs_fs_type);
+  if (ret != 0) {
+    goto exit_transport;
+  }
+  printk(KERN_INFO "Init fs\n");
+  return 0;
+
+exit_transport:
+  networkfs_transport_exit();
+destroy_compound:
+  networkfs_compound_cache_exit();
+destroy_content:
+  kmem_cache_destroy(networkfs_content_cachep);
+destroy_inode:
+  kmem_cache_destroy(networkfs_inode_cachep);
+destroy_dir:
+  kmem_cache_destroy(networkfs_dir_cachep);
+  return ret;
 }
 
 void networkfs_exit(void) {
@@ -252,6 +2179,13 @@ void networkfs_exit(void) {
   if (ret != 0) {
     printk(KERN_ERR "networkfs: error in unregister: error code %d", ret);
   }
+  networkfs_transport_exit();
+  networkfs_compound_cache_exit();
+  // Inodes are freed after an RCU grace period
+  rcu_barrier();
+  kmem_cache_destroy(networkfs_content_cachep);
+  kmem_cache_destroy(networkfs_inode_cachep);
+  kmem_cache_destroy(networkfs_dir_cachep);
   printk(KERN_INFO "Exit fs\n");
 }
 
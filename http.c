@@ -1,198 +1,996 @@
 #include "http.h"
 
+#include <linux/ctype.h>
+#include <linux/err.h>
 #include <linux/inet.h>
+#include <linux/kernel.h>
+#include <linux/mempool.h>
+#include <linux/net.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/tcp.h>
+#include <net/sock.h>
+
+#include "models.h"
+#include "transport.h"
+#include "v2.h"
 
 const char *HTTP_REQUEST_LINE = "GET /teaching/os/networkfs/v1/";
 const char *HTTP_REQUEST_HEADERS =
-    " HTTP/1.1\r\nHost:nerc.itmo.ru\r\nConnection: close\r\n\r\n";
-const char *SERVER_IP = "77.234.215.132";
-const char *HTTP_LENGTH_HEADER = "Content-Length: ";
-
-// callee should call free_request on received buffer
-int fill_request(struct kvec *vec, const char *token, const char *method,
-                 size_t arg_size, va_list args) {
-  // 2048 bytes for URL and 64 bytes for anything else
-  char *request_buffer = kzalloc(2048 + 64, GFP_KERNEL);
-  if (request_buffer == 0) {
-    return -ENOMEM;
+    " HTTP/1.1\r\nHost:nerc.itmo.ru\r\nConnection: keep-alive\r\n";
+const char *HTTP_IF_NONE_MATCH_HEADER = "If-None-Match: ";
+const char *HTTP_ETAG_HEADER = "ETag:";
+const char *HTTP_LENGTH_HEADER = "Content-Length:";
+const char *HTTP_ENCODING_HEADER = "Transfer-Encoding:";
+const char *HTTP_CONNECTION_HEADER = "Connection:";
+
+// Request line prefix, method, query, headers, If-None-Match header with its
+// value and line end, and the empty line
+#define HTTP_REQUEST_MAX_VECS 8
+
+// Queries up to this long are rendered into pooled buffers, longer ones are
+// rare: contents and paths full of reserved characters
+#define HTTP_QUERY_BUFFER_SIZE 1024
+// Query buffers kept in reserve for each mount
+#define HTTP_MIN_QUERY_BUFFERS 4
+
+struct kmem_cache *networkfs_connection_cachep;
+struct kmem_cache *networkfs_query_cachep;
+
+/**
+ * struct networkfs_http_transport - HTTP backend of a mount.
+ * @transport:   Generic transport.
+ * @token:       Unique filesystem token.
+ * @prefix:      Rendered "GET /.../<token>/fs/" shared by all requests.
+ * @prefix_size: Length of @prefix.
+ * @queries:     Buffers for rendered queries of HTTP_QUERY_BUFFER_SIZE.
+ * @pool:        Connections to the API server.
+ * @v2:          Binary protocol session, NULL if server speaks only HTTP API.
+ * @watch_lock:  Protects @watch_conn and @interrupted.
+ * @watch_conn:  Connection kept for long-poll calls, or NULL.
+ * @interrupted: Set once long-poll calls have to stop.
+ */
+struct networkfs_http_transport {
+  struct networkfs_transport transport;
+  char *token;
+  char *prefix;
+  size_t prefix_size;
+  mempool_t *queries;
+  struct networkfs_connection_pool pool;
+  struct networkfs_v2_session *v2;
+  struct mutex watch_lock;
+  struct networkfs_connection *watch_conn;
+  bool interrupted;
+};
+
+#define HTTP_TRANSPORT(t) \
+  container_of(t, struct networkfs_http_transport, transport)
+
+void fill_vec(struct kvec *vec, const char *base, size_t length) {
+  vec->iov_base = (char *)base;
+  vec->iov_len = length;
+}
+
+bool http_unreserved(char c) {
+  return isascii(c) &&
+         (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~');
+}
+
+// Length of "?key=value&..." rendered from @call, terminator included
+size_t http_query_size(const struct networkfs_call *call) {
+  size_t size = 1;
+  for (int i = 0; i < call->arg_size; i++) {
+    size += strlen(call->args[2 * i]) + 2;
+    for (const char *value = call->args[2 * i + 1]; *value != '\0'; value++) {
+      size += http_unreserved(*value) ? 1 : 3;
+    }
   }
+  return size;
+}
 
-  strcpy(request_buffer, HTTP_REQUEST_LINE);
-  strcat(request_buffer, token);
-  strcat(request_buffer, "/fs/");
-  strcat(request_buffer, method);
+// Renders "?key=value&..." with every value percent-encoded, so names and
+// contents cannot end the request line, cut the query or add headers.
+// Returns NULL if out of memory, the caller frees the query with
+// http_free_query().
+char *http_render_query(struct networkfs_http_transport *http,
+                        const struct networkfs_call *call) {
+  size_t size = http_query_size(call);
+  char *query = size <= HTTP_QUERY_BUFFER_SIZE
+                    ? mempool_alloc(http->queries, GFP_KERNEL)
+                    : kmalloc(size, GFP_KERNEL);
+  if (query == NULL) {
+    return NULL;
+  }
 
-  for (int i = 0; i < arg_size; i++) {
-    strcat(request_buffer, i == 0 ? "?" : "&");
-    strcat(request_buffer, va_arg(args, char *));
-    strcat(request_buffer, "=");
-    strcat(request_buffer, va_arg(args, char *));
+  char *position = query;
+  for (int i = 0; i < call->arg_size; i++) {
+    const char *key = call->args[2 * i];
+    const char *value = call->args[2 * i + 1];
+
+    *position++ = i == 0 ? '?' : '&';
+    memcpy(position, key, strlen(key));
+    position += strlen(key);
+    *position++ = '=';
+    for (; *value != '\0'; value++) {
+      if (http_unreserved(*value)) {
+        *position++ = *value;
+      } else {
+        *position++ = '%';
+        position = hex_byte_pack_upper(position, *value);
+      }
+    }
   }
+  *position = '\0';
+  return query;
+}
 
-  strcat(request_buffer, HTTP_REQUEST_HEADERS);
+void http_free_query(struct networkfs_http_transport *http, char *query) {
+  if (strlen(query) < HTTP_QUERY_BUFFER_SIZE) {
+    mempool_free(query, http->queries);
+  } else {
+    kfree(query);
+  }
+}
 
-  memset(vec, 0, sizeof(struct kvec));
-  vec->iov_base = request_buffer;
-  vec->iov_len = strlen(request_buffer);
+// Describes request as pieces pointing to the prefix, the method, the
+// rendered @query and the headers. Returns number of pieces.
+size_t fill_request(struct kvec *vec, size_t *length,
+                    const struct networkfs_http_transport *http,
+                    const struct networkfs_call *call, const char *query) {
+  size_t count = 0;
+
+  fill_vec(&vec[count++], http->prefix, http->prefix_size);
+  fill_vec(&vec[count++], call->method, strlen(call->method));
+  fill_vec(&vec[count++], query, strlen(query));
+
+  fill_vec(&vec[count++], HTTP_REQUEST_HEADERS, strlen(HTTP_REQUEST_HEADERS));
+  if (call->conditional && call->if_none_match != NULL) {
+    fill_vec(&vec[count++], HTTP_IF_NONE_MATCH_HEADER,
+             strlen(HTTP_IF_NONE_MATCH_HEADER));
+    fill_vec(&vec[count++], call->if_none_match, strlen(call->if_none_match));
+    fill_vec(&vec[count++], "\r\n", 2);
+  }
+  fill_vec(&vec[count++], "\r\n", 2);
 
+  *length = 0;
+  for (int i = 0; i < count; i++) {
+    *length += vec[i].iov_len;
+  }
+
+  return count;
+}
+
+/*
+ * Response parser. The status line, headers and chunk framing are read into
+ * the scratch area of the connection, while the body is received straight
+ * into the caller's memory. Bytes read past the end of a response stay in the
+ * scratch area for the next pipelined response.
+ */
+
+enum http_parser_state {
+  HTTP_STATUS_LINE,
+  HTTP_HEADERS,
+  HTTP_BODY,
+  HTTP_CHUNK_SIZE,
+  HTTP_CHUNK_DATA,
+  HTTP_CHUNK_END,
+  HTTP_TRAILERS,
+  HTTP_DONE
+};
+
+struct http_parser {
+  enum http_parser_state state;
+  int status_code;
+  bool keep_alive;
+  bool chunked;
+  bool has_length;
+  size_t content_length;
+  size_t remaining;  // bytes left in the body or the current chunk
+  char *etag;        // NETWORKFS_ETAG_SIZE bytes for ETag, or NULL
+};
+
+// Destination of the response body, usually the status followed by the
+// caller's buffer. Bytes past its end are passed to @consume if the caller
+// streams the response, otherwise counted but dropped.
+struct http_body_sink {
+  struct kvec vec[2];
+  size_t count;
+  size_t received;
+  int (*consume)(void *data, const char *piece, size_t size);
+  void *consume_data;
+};
+
+// Describes free space of the sink for the next @size bytes
+size_t http_sink_room(const struct http_body_sink *sink, size_t size,
+                      struct kvec *room, size_t *room_size) {
+  size_t offset = sink->received;
+  size_t count = 0;
+
+  *room_size = 0;
+  for (int i = 0; i < sink->count && size > 0; i++) {
+    if (offset >= sink->vec[i].iov_len) {
+      offset -= sink->vec[i].iov_len;
+      continue;
+    }
+    size_t length = min(sink->vec[i].iov_len - offset, size);
+    room[count].iov_base = (char *)sink->vec[i].iov_base + offset;
+    room[count].iov_len = length;
+    ++count;
+    *room_size += length;
+    size -= length;
+    offset = 0;
+  }
+
+  return count;
+}
+
+int http_sink_copy(struct http_body_sink *sink, const char *data,
+                   size_t size) {
+  struct kvec room[ARRAY_SIZE(sink->vec)];
+  size_t room_size;
+  size_t room_count = http_sink_room(sink, size, room, &room_size);
+
+  for (int i = 0; i < room_count; i++) {
+    memcpy(room[i].iov_base, data, room[i].iov_len);
+    data += room[i].iov_len;
+  }
+  sink->received += size;
+
+  if (sink->consume != NULL && size > room_size) {
+    return sink->consume(sink->consume_data, data, size - room_size);
+  }
   return 0;
 }
 
-int receive_all(struct socket *sock, char *buffer, size_t buffer_size) {
+// Receives more bytes into the scratch area
+int http_scratch_fill(struct networkfs_connection *conn) {
   struct msghdr hdr;
   struct kvec vec;
 
-  int read = 0;
+  if (conn->scratch_start == conn->scratch_end) {
+    conn->scratch_start = conn->scratch_end = 0;
+  } else if (conn->scratch_end == NETWORKFS_SCRATCH_SIZE) {
+    memmove(conn->scratch, conn->scratch + conn->scratch_start,
+            conn->scratch_end - conn->scratch_start);
+    conn->scratch_end -= conn->scratch_start;
+    conn->scratch_start = 0;
+  }
+  if (conn->scratch_end == NETWORKFS_SCRATCH_SIZE) {
+    // A single line does not fit
+    return -EHTTPMALFORMED;
+  }
 
-  while (read < buffer_size) {
-    memset(&hdr, 0, sizeof(struct msghdr));
-    memset(&vec, 0, sizeof(struct kvec));
-    vec.iov_base = buffer + read;
-    vec.iov_len = buffer_size - read;
-    int ret = kernel_recvmsg(sock, &hdr, &vec, 1, vec.iov_len, 0);
-    if (ret == 0) {
-      break;
-    } else if (ret < 0) {
-      return ESOCKNOMSGRECV;
-    }
-    read += ret;
+  memset(&hdr, 0, sizeof(struct msghdr));
+  vec.iov_base = conn->scratch + conn->scratch_end;
+  vec.iov_len = NETWORKFS_SCRATCH_SIZE - conn->scratch_end;
+  int ret = kernel_recvmsg(conn->sock, &hdr, &vec, 1, vec.iov_len, 0);
+  if (ret == 0 || ret == -ECONNRESET || ret == -EPIPE) {
+    return -ECONNRESET;
+  } else if (ret < 0) {
+    return -ESOCKNOMSGRECV;
   }
 
-  return read;
+  conn->scratch_end += ret;
+  return 0;
 }
 
-int64_t parse_http_response(char *raw_response, size_t raw_response_size,
-                            char *response, size_t response_size) {
-  char *buffer = raw_response;
-
-  // Read Response Line
-  {
-    char *status_line = strsep(&buffer, "\r");
-    strsep(&status_line, " ");
-    if (status_line == 0) {
-      return -EHTTPMALFORMED;
+// Takes the next CRLF-terminated line. It stays valid until the next read.
+int http_read_line(struct networkfs_connection *conn, char **line) {
+  while (true) {
+    char *start = conn->scratch + conn->scratch_start;
+    char *end = strnstr(start, "\r\n", conn->scratch_end - conn->scratch_start);
+    if (end != NULL) {
+      *end = '\0';
+      *line = start;
+      conn->scratch_start += end + 2 - start;
+      return 0;
     }
-    char *status_code = strsep(&status_line, " ");
-    if (strcmp(status_code, "200") != 0) {
-      return -EHTTPBADCODE;
+
+    int error = http_scratch_fill(conn);
+    if (error != 0) {
+      return error;
     }
   }
+}
 
-  int length = -1;
-
-  while (true) {
-    if (buffer == 0) {
-      return -EHTTPMALFORMED;
-    }
-    char *header = strsep(&buffer, "\r");
-    ++header;  // skip \n
-    if (strcmp(header, "") == 0) {
-      // end of headers
-      break;
+// Moves @size bytes of the body into the sink. Bytes already buffered are
+// copied, the rest is received right into the sink. What does not fit into
+// the sink goes through the scratch area and is consumed or dropped.
+int http_read_body(struct networkfs_connection *conn,
+                   struct http_body_sink *sink, size_t size) {
+  struct msghdr hdr;
+  struct kvec room[ARRAY_SIZE(sink->vec)];
+  size_t room_size;
+
+  while (size > 0) {
+    size_t buffered = conn->scratch_end - conn->scratch_start;
+    if (buffered > 0) {
+      size_t length = min(size, buffered);
+      int error =
+          http_sink_copy(sink, conn->scratch + conn->scratch_start, length);
+      conn->scratch_start += length;
+      size -= length;
+      if (error != 0) {
+        return error;
+      }
+      continue;
     }
 
-    if (strncmp(header, HTTP_LENGTH_HEADER, strlen(HTTP_LENGTH_HEADER)) == 0) {
-      int error = kstrtoint(header + strlen(HTTP_LENGTH_HEADER), 0, &length);
+    size_t room_count = http_sink_room(sink, size, room, &room_size);
+    if (room_count == 0) {
+      int error = http_scratch_fill(conn);
       if (error != 0) {
-        return -EHTTPMALFORMED;
+        return error;
       }
+      continue;
+    }
+
+    memset(&hdr, 0, sizeof(struct msghdr));
+    int ret = kernel_recvmsg(conn->sock, &hdr, room, room_count, room_size, 0);
+    if (ret <= 0) {
+      return -ESOCKNOMSGRECV;
     }
+    sink->received += ret;
+    size -= ret;
   }
-  ++buffer;  // skip last '\n'
 
-  if (length == -1) {
-    return -EHTTPMALFORMED;
+  return 0;
+}
+
+// Returns header value if the header is called @name, otherwise NULL
+const char *http_header_value(const char *header, const char *name) {
+  size_t length = strlen(name);
+  if (strncasecmp(header, name, length) != 0) {
+    return NULL;
   }
+  return skip_spaces(header + length);
+}
 
-  if (buffer + length > raw_response + raw_response_size) {
-    return -EHTTPMALFORMED;
+int http_parse_header(struct http_parser *parser, const char *header) {
+  const char *value;
+
+  if ((value = http_header_value(header, HTTP_LENGTH_HEADER)) != NULL) {
+    unsigned long length;
+    if (kstrtoul(value, 10, &length) != 0) {
+      return -EHTTPMALFORMED;
+    }
+    parser->content_length = length;
+    parser->has_length = true;
+  } else if ((value = http_header_value(header, HTTP_ENCODING_HEADER)) !=
+             NULL) {
+    parser->chunked = strcasecmp(value, "chunked") == 0;
+  } else if ((value = http_header_value(header, HTTP_CONNECTION_HEADER)) !=
+             NULL) {
+    parser->keep_alive = strcasecmp(value, "close") != 0;
+  } else if ((value = http_header_value(header, HTTP_ETAG_HEADER)) != NULL &&
+             parser->etag != NULL) {
+    // Tag too long to be kept is as good as none
+    if (strscpy(parser->etag, value, NETWORKFS_ETAG_SIZE) < 0) {
+      parser->etag[0] = '\0';
+    }
   }
 
-  if (length < sizeof(int64_t)) {
-    return -EPROTMALFORMED;
+  return 0;
+}
+
+// Picks how the body is framed once all headers are read
+int http_parse_headers_end(struct http_parser *parser,
+                           struct http_body_sink *sink) {
+  if (parser->status_code != 200) {
+    // Error bodies are dropped, caller's buffer stays unaltered
+    sink->count = 0;
+    sink->consume = NULL;
   }
 
-  length -= sizeof(int64_t);
+  if (parser->status_code == 204 || parser->status_code == 304) {
+    parser->state = HTTP_DONE;
+  } else if (parser->chunked) {
+    parser->state = HTTP_CHUNK_SIZE;
+  } else if (parser->has_length) {
+    parser->remaining = parser->content_length;
+    parser->state = HTTP_BODY;
+  } else {
+    return -EHTTPMALFORMED;
+  }
 
-  if (length > response_size) {
-    return -ENOSPC;
+  return 0;
+}
+
+int http_parse_step(struct networkfs_connection *conn,
+                    struct http_parser *parser, struct http_body_sink *sink) {
+  unsigned long chunk_size;
+  int minor_version;
+  char *line;
+  int error;
+
+  switch (parser->state) {
+    case HTTP_STATUS_LINE:
+      error = http_read_line(conn, &line);
+      if (error != 0) {
+        return error;
+      }
+      if (sscanf(line, "HTTP/1.%d %d", &minor_version,
+                 &parser->status_code) != 2) {
+        return -EHTTPMALFORMED;
+      }
+      parser->keep_alive = minor_version > 0;
+      parser->state = HTTP_HEADERS;
+      return 0;
+
+    case HTTP_HEADERS:
+      error = http_read_line(conn, &line);
+      if (error != 0) {
+        return error;
+      }
+      if (*line == '\0') {
+        return http_parse_headers_end(parser, sink);
+      }
+      return http_parse_header(parser, line);
+
+    case HTTP_BODY:
+      error = http_read_body(conn, sink, parser->remaining);
+      parser->state = HTTP_DONE;
+      return error;
+
+    case HTTP_CHUNK_SIZE:
+      error = http_read_line(conn, &line);
+      if (error != 0) {
+        return error;
+      }
+      // Chunk extensions are ignored
+      strreplace(line, ';', '\0');
+      if (kstrtoul(strim(line), 16, &chunk_size) != 0) {
+        return -EHTTPMALFORMED;
+      }
+      parser->remaining = chunk_size;
+      parser->state = chunk_size == 0 ? HTTP_TRAILERS : HTTP_CHUNK_DATA;
+      return 0;
+
+    case HTTP_CHUNK_DATA:
+      error = http_read_body(conn, sink, parser->remaining);
+      parser->state = HTTP_CHUNK_END;
+      return error;
+
+    case HTTP_CHUNK_END:
+      error = http_read_line(conn, &line);
+      if (error == 0 && *line != '\0') {
+        error = -EHTTPMALFORMED;
+      }
+      parser->state = HTTP_CHUNK_SIZE;
+      return error;
+
+    case HTTP_TRAILERS:
+      error = http_read_line(conn, &line);
+      if (error == 0 && *line == '\0') {
+        parser->state = HTTP_DONE;
+      }
+      return error;
+
+    default:
+      return 0;
   }
+}
 
-  int64_t return_value;
-  memcpy(&return_value, buffer, sizeof(int64_t));
+// Reads exactly one response from the connection, so that it can be reused
+// for the next one. -ECONNRESET means that the server closed the connection
+// before sending anything.
+int http_receive_response(struct networkfs_connection *conn,
+                          struct http_parser *parser,
+                          struct http_body_sink *sink, char *etag) {
+  memset(parser, 0, sizeof(struct http_parser));
+  parser->state = HTTP_STATUS_LINE;
+  parser->etag = etag;
+
+  while (parser->state != HTTP_DONE) {
+    bool started = parser->state != HTTP_STATUS_LINE ||
+                   conn->scratch_start != conn->scratch_end;
+    int error = http_parse_step(conn, parser, sink);
+    if (error == -ECONNRESET && started) {
+      error = -ESOCKNOMSGRECV;
+    }
+    if (error != 0) {
+      return error;
+    }
+  }
 
-  buffer += sizeof(int64_t);
-  memcpy(response, buffer, length);
+  return 0;
+}
 
-  return return_value;
+void networkfs_connection_close(struct networkfs_connection *conn) {
+  kernel_sock_shutdown(conn->sock, SHUT_RDWR);
+  sock_release(conn->sock);
+  kmem_cache_free(networkfs_connection_cachep, conn);
 }
 
-int64_t networkfs_http_call(const char *token, const char *method,
-                            char *response_buffer, size_t buffer_size,
-                            size_t arg_size, ...) {
-  struct socket *sock;
-  int64_t error;
+int networkfs_socket_connect(const struct sockaddr_in *addr,
+                             struct socket **sock) {
+  int error;
 
-  error = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP, &sock);
+  error = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP, sock);
   if (error < 0) {
     return -ESOCKNOCREATE;
   }
 
-  struct sockaddr_in s_addr = {.sin_family = AF_INET,
-                               .sin_addr = {.s_addr = in_aton(SERVER_IP)},
-                               .sin_port = htons(80)};
-
-  error = kernel_connect(sock, (struct sockaddr *)&s_addr,
+  error = kernel_connect(*sock, (struct sockaddr *)addr,
                          sizeof(struct sockaddr_in), 0);
   if (error != 0) {
-    sock_release(sock);
+    sock_release(*sock);
     return -ESOCKNOCONNECT;
   }
 
-  struct kvec kvec;
-  va_list args;
-  va_start(args, arg_size);
-  error = fill_request(&kvec, token, method, arg_size, args);
-  va_end(args);
+  // Requests are small and always wait for the answer
+  tcp_sock_set_nodelay((*sock)->sk);
+
+  // Server that stops answering fails the calls instead of hanging them
+  struct sock *sk = (*sock)->sk;
+  lock_sock(sk);
+  sk->sk_rcvtimeo = NETWORKFS_SOCKET_TIMEOUT;
+  sk->sk_sndtimeo = NETWORKFS_SOCKET_TIMEOUT;
+  release_sock(sk);
+
+  return 0;
+}
+
+struct networkfs_connection *networkfs_connection_open(
+    const struct sockaddr_in *addr) {
+  struct networkfs_connection *conn;
+  int error;
+
+  conn = kmem_cache_zalloc(networkfs_connection_cachep, GFP_KERNEL);
+  if (conn == NULL) {
+    return ERR_PTR(-ENOMEM);
+  }
+
+  error = networkfs_socket_connect(addr, &conn->sock);
+  if (error != 0) {
+    kmem_cache_free(networkfs_connection_cachep, conn);
+    return ERR_PTR(error);
+  }
+
+  mutex_init(&conn->send_lock);
+  init_waitqueue_head(&conn->waiters);
+  conn->last_used = jiffies;
+
+  return conn;
+}
+
+// Whether the server has closed its end, e.g. of a connection it found idle
+bool networkfs_connection_closed(const struct networkfs_connection *conn) {
+  return READ_ONCE(conn->sock->sk->sk_state) != TCP_ESTABLISHED;
+}
+
+// Marks connection as unusable. Requests still waiting on it fail with @error.
+void networkfs_connection_break(struct networkfs_connection *conn, int error) {
+  cmpxchg(&conn->error, 0, error);
+  wake_up_all(&conn->waiters);
+}
+
+// Sends request and waits for its response in the pipeline.
+// Returns status returned by the server or negated error. -ECONNRESET means
+// that the request may be sent again: the server dropped it unprocessed, or
+// closed the connection without answering an idempotent call. Connections
+// broken after requests went out carry -ECONNABORTED, as the server may have
+// acted on them. @pool is the pool @conn belongs to, if any.
+int64_t networkfs_connection_call(struct networkfs_connection_pool *pool,
+                                  struct networkfs_connection *conn,
+                                  struct kvec *request, size_t request_count,
+                                  size_t request_size,
+                                  struct networkfs_call *call) {
+  u64 ticket;
+  int error;
+
+  mutex_lock(&conn->send_lock);
+  error = READ_ONCE(conn->error);
+  if (error == 0) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+
+    ticket = conn->next_ticket++;
+    int sent = kernel_sendmsg(conn->sock, &msg, request, request_count,
+                              request_size);
+    if (sent != (int)request_size) {
+      // The server can not act on a request it did not get whole, but may
+      // have on the ones sent before
+      networkfs_connection_break(conn, -ECONNABORTED);
+      error = sent == -EPIPE || sent == -ECONNRESET ? -ECONNRESET
+                                                    : -ESOCKNOMSGSEND;
+    }
+  }
+  mutex_unlock(&conn->send_lock);
 
   if (error != 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
     return error;
   }
 
-  struct msghdr msg;
-  memset(&msg, 0, sizeof(struct msghdr));
+  if (wait_event_killable(conn->waiters,
+                          READ_ONCE(conn->serving) == ticket ||
+                              READ_ONCE(conn->error) != 0) != 0) {
+    // Nobody is going to read the response, so the ones after it can not be
+    // told apart
+    networkfs_connection_break(conn, -ECONNABORTED);
+    return -EINTR;
+  }
+  error = READ_ONCE(conn->error);
+  if (error != 0) {
+    goto broken;
+  }
+
+  int64_t status;
+  struct http_body_sink sink = {
+      .vec = {{&status, sizeof(status)},
+              {call->response_buffer, call->buffer_size}},
+      .count = call->consume != NULL ? 1 : 2,
+      .consume = call->consume,
+      .consume_data = call->consume_data};
+  struct http_parser parser;
+  error = http_receive_response(conn, &parser, &sink,
+                                call->conditional ? call->etag : NULL);
+  if (error == -ECONNRESET) {
+    // Closed without a word: the server may have got the request first
+    error = -ECONNABORTED;
+  }
+  if (error != 0) {
+    networkfs_connection_break(conn, error);
+  } else if (!parser.keep_alive) {
+    // Everything pipelined after this response is dropped by the server. A
+    // connection closed after its first response tells the server does not
+    // keep connections alive, later closes are its own business.
+    if (pool != NULL && ticket == 0) {
+      WRITE_ONCE(pool->pipelining, false);
+    }
+    networkfs_connection_break(conn, -ECONNRESET);
+  } else if (pool != NULL && ticket == 0) {
+    WRITE_ONCE(pool->pipelining, true);
+  }
 
-  error = kernel_sendmsg(sock, &msg, &kvec, 1, kvec.iov_len);
-  kfree(kvec.iov_base);
+  WRITE_ONCE(conn->serving, ticket + 1);
+  wake_up_all(&conn->waiters);
 
-  if (error < 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
-    return -ESOCKNOMSGSEND;
+  if (error != 0) {
+    goto broken;
+  } else if (parser.status_code == 304 && call->if_none_match != NULL) {
+    call->response_size = 0;
+    return NETWORKFS_ENOTMODIFIED;
+  } else if (parser.status_code != 200) {
+    return -EHTTPBADCODE;
+  } else if (sink.received < sizeof(status)) {
+    return -EPROTMALFORMED;
+  }
+
+  call->response_size = sink.received - sizeof(status);
+  if (call->consume == NULL && call->response_size > call->buffer_size) {
+    return -ENOSPC;
+  }
+  return status;
+
+broken:
+  if (error == -ECONNABORTED) {
+    return call->idempotent ? -ECONNRESET : -ESOCKNOMSGRECV;
+  }
+  return error;
+}
+
+void networkfs_pool_reap(struct work_struct *work) {
+  struct networkfs_connection_pool *pool = container_of(
+      to_delayed_work(work), struct networkfs_connection_pool, reaper);
+  struct networkfs_connection *conn, *tmp;
+  LIST_HEAD(expired);
+  bool reschedule;
+
+  spin_lock(&pool->lock);
+  list_for_each_entry_safe(conn, tmp, &pool->connections, list) {
+    if (conn->inflight == 0 &&
+        time_after(jiffies, conn->last_used + NETWORKFS_POOL_IDLE_TIMEOUT)) {
+      list_move(&conn->list, &expired);
+      --pool->count;
+    }
+  }
+  reschedule = pool->count > 0;
+  spin_unlock(&pool->lock);
+
+  list_for_each_entry_safe(conn, tmp, &expired, list) {
+    networkfs_connection_close(conn);
+  }
+
+  if (reschedule) {
+    schedule_delayed_work(&pool->reaper, NETWORKFS_POOL_REAP_INTERVAL);
+  }
+}
+
+void networkfs_pool_init(struct networkfs_connection_pool *pool,
+                         const struct sockaddr_in *addr) {
+  pool->addr = *addr;
+  spin_lock_init(&pool->lock);
+  INIT_LIST_HEAD(&pool->connections);
+  pool->count = 0;
+  pool->pipelining = true;
+  INIT_DELAYED_WORK(&pool->reaper, networkfs_pool_reap);
+}
+
+void networkfs_pool_destroy(struct networkfs_connection_pool *pool) {
+  struct networkfs_connection *conn, *tmp;
+
+  cancel_delayed_work_sync(&pool->reaper);
+
+  list_for_each_entry_safe(conn, tmp, &pool->connections, list) {
+    list_del(&conn->list);
+    networkfs_connection_close(conn);
+  }
+  pool->count = 0;
+}
+
+// Picks the least loaded usable connection, opening a new one while the
+// others have a deep enough pipeline. Idle connections the server has closed
+// are dropped, so no request is sent over them.
+struct networkfs_connection *networkfs_pool_acquire(
+    struct networkfs_connection_pool *pool) {
+  struct networkfs_connection *conn, *tmp, *best = NULL;
+  LIST_HEAD(closed);
+
+  spin_lock(&pool->lock);
+  bool pipelining = pool->pipelining;
+  list_for_each_entry_safe(conn, tmp, &pool->connections, list) {
+    if (conn->inflight == 0 && networkfs_connection_closed(conn)) {
+      list_move(&conn->list, &closed);
+      --pool->count;
+      continue;
+    }
+    if (READ_ONCE(conn->error) != 0) {
+      continue;
+    }
+    if (best == NULL || conn->inflight < best->inflight) {
+      best = conn;
+    }
+  }
+  if (best != NULL &&
+      !(best->inflight == 0 ||
+        (pipelining && (best->inflight < NETWORKFS_PIPELINE_DEPTH ||
+                        pool->count >= NETWORKFS_POOL_MAX_CONNECTIONS)))) {
+    best = NULL;
+  }
+  if (best != NULL) {
+    ++best->inflight;
+  }
+  spin_unlock(&pool->lock);
+
+  list_for_each_entry_safe(conn, tmp, &closed, list) {
+    networkfs_connection_close(conn);
+  }
+  if (best != NULL) {
+    return best;
+  }
+
+  conn = networkfs_connection_open(&pool->addr);
+  if (IS_ERR(conn)) {
+    return conn;
+  }
+  conn->inflight = 1;
+
+  spin_lock(&pool->lock);
+  list_add(&conn->list, &pool->connections);
+  ++pool->count;
+  spin_unlock(&pool->lock);
+
+  schedule_delayed_work(&pool->reaper, NETWORKFS_POOL_REAP_INTERVAL);
+  return conn;
+}
+
+void networkfs_pool_release(struct networkfs_connection_pool *pool,
+                            struct networkfs_connection *conn) {
+  bool close = false;
+
+  spin_lock(&pool->lock);
+  conn->last_used = jiffies;
+  if (--conn->inflight == 0 && READ_ONCE(conn->error) != 0) {
+    list_del(&conn->list);
+    --pool->count;
+    close = true;
   }
+  spin_unlock(&pool->lock);
 
-  size_t raw_buffer_size = buffer_size + 1024;  // add 1KB for HTTP headers
-  char *raw_response_buffer = kmalloc(raw_buffer_size, GFP_KERNEL);
-  if (raw_response_buffer == 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
+  if (close) {
+    networkfs_connection_close(conn);
+  }
+}
+
+int64_t networkfs_pool_call(struct networkfs_http_transport *http,
+                            struct networkfs_call *call) {
+  struct kvec request[HTTP_REQUEST_MAX_VECS];
+  size_t request_size;
+  char *query = http_render_query(http, call);
+  if (query == NULL) {
     return -ENOMEM;
   }
-  int read_bytes = receive_all(sock, raw_response_buffer, raw_buffer_size);
+  size_t request_count =
+      fill_request(request, &request_size, http, call, query);
 
-  kernel_sock_shutdown(sock, SHUT_RDWR);
-  sock_release(sock);
+  int64_t ret = -ECONNRESET;
 
-  if (read_bytes < 0) {
-    kfree(raw_response_buffer);
-    return -ESOCKNOMSGRECV;
+  for (int attempt = 0; attempt < NETWORKFS_CALL_ATTEMPTS && ret == -ECONNRESET;
+       ++attempt) {
+    struct networkfs_connection *conn = networkfs_pool_acquire(&http->pool);
+    if (IS_ERR(conn)) {
+      ret = PTR_ERR(conn);
+      break;
+    }
+
+    ret = networkfs_connection_call(&http->pool, conn, request, request_count,
+                                    request_size, call);
+    networkfs_pool_release(&http->pool, conn);
   }
 
-  error = parse_http_response(raw_response_buffer, read_bytes, response_buffer,
-                              buffer_size);
+  http_free_query(http, query);
+  return ret == -ECONNRESET ? -ESOCKNOMSGRECV : ret;
+}
 
-  kfree(raw_response_buffer);
-  return error;
+// Makes a call over binary protocol when negotiated, otherwise over HTTP API
+int64_t networkfs_http_transport_call(struct networkfs_transport *transport,
+                                      struct networkfs_call *call) {
+  struct networkfs_http_transport *http = HTTP_TRANSPORT(transport);
+
+  if (http->v2 != NULL) {
+    int64_t ret = networkfs_v2_call(http->v2, call);
+    if (ret != -ENOTCONN && ret != -EOPNOTSUPP) {
+      return ret;
+    }
+  }
+
+  return networkfs_pool_call(http, call);
+}
+
+int networkfs_http_transport_call_async(struct networkfs_transport *transport,
+                                        struct networkfs_call *call) {
+  struct networkfs_http_transport *http = HTTP_TRANSPORT(transport);
+
+  if (http->v2 != NULL) {
+    int error = networkfs_v2_call_async(http->v2, call);
+    if (error != -ENOTCONN && error != -EOPNOTSUPP) {
+      return error;
+    }
+  }
+
+  return networkfs_call_async_sync(transport, call);
+}
+
+// Long-poll calls get a connection of their own, which is never shared with
+// the pool, so a held response does not delay other calls
+int64_t networkfs_http_transport_watch(struct networkfs_transport *transport,
+                                       struct networkfs_call *call) {
+  struct networkfs_http_transport *http = HTTP_TRANSPORT(transport);
+  struct networkfs_connection *conn;
+  struct kvec request[HTTP_REQUEST_MAX_VECS];
+  size_t request_size;
+  int64_t ret;
+  char *query = http_render_query(http, call);
+  if (query == NULL) {
+    return -ENOMEM;
+  }
+  size_t request_count =
+      fill_request(request, &request_size, http, call, query);
+
+  mutex_lock(&http->watch_lock);
+  if (http->interrupted) {
+    mutex_unlock(&http->watch_lock);
+    ret = -EINTR;
+    goto out;
+  }
+  conn = http->watch_conn;
+  if (conn != NULL && READ_ONCE(conn->error) != 0) {
+    networkfs_connection_close(conn);
+    conn = NULL;
+  }
+  if (conn == NULL) {
+    conn = networkfs_connection_open(&http->pool.addr);
+    if (IS_ERR(conn)) {
+      http->watch_conn = NULL;
+      mutex_unlock(&http->watch_lock);
+      ret = PTR_ERR(conn);
+      goto out;
+    }
+  }
+  http->watch_conn = conn;
+  mutex_unlock(&http->watch_lock);
+
+  // Watch connection is not pooled, its closes say nothing about the pool
+  ret = networkfs_connection_call(NULL, conn, request, request_count,
+                                  request_size, call);
+  if (READ_ONCE(http->interrupted)) {
+    ret = -EINTR;
+  } else if (ret == -ECONNRESET) {
+    ret = -ESOCKNOMSGRECV;
+  }
+
+out:
+  http_free_query(http, query);
+  return ret;
+}
+
+void networkfs_http_transport_interrupt(struct networkfs_transport *transport) {
+  struct networkfs_http_transport *http = HTTP_TRANSPORT(transport);
+
+  mutex_lock(&http->watch_lock);
+  WRITE_ONCE(http->interrupted, true);
+  if (http->watch_conn != NULL) {
+    // Wakes the receiver blocked on a held response
+    kernel_sock_shutdown(http->watch_conn->sock, SHUT_RDWR);
+  }
+  mutex_unlock(&http->watch_lock);
+}
+
+void networkfs_http_transport_teardown(struct networkfs_transport *transport) {
+  struct networkfs_http_transport *http = HTTP_TRANSPORT(transport);
+
+  if (http->v2 != NULL) {
+    networkfs_v2_close(http->v2);
+  }
+  if (http->watch_conn != NULL) {
+    networkfs_connection_close(http->watch_conn);
+  }
+  networkfs_pool_destroy(&http->pool);
+  mempool_destroy(http->queries);
+  kfree(http->prefix);
+  kfree(http->token);
+  kfree(http);
+}
+
+const struct networkfs_transport_ops networkfs_http_transport_ops = {
+    .call = networkfs_http_transport_call,
+    .call_async = networkfs_http_transport_call_async,
+    .watch = networkfs_http_transport_watch,
+    .interrupt = networkfs_http_transport_interrupt,
+    .teardown = networkfs_http_transport_teardown};
+
+struct networkfs_transport *networkfs_http_transport_create(
+    const struct networkfs_transport_config *config) {
+  struct networkfs_http_transport *http =
+      kzalloc(sizeof(struct networkfs_http_transport), GFP_KERNEL);
+  if (http == NULL) {
+    return ERR_PTR(-ENOMEM);
+  }
+
+  http->token = kstrdup(config->token, GFP_KERNEL);
+  http->prefix = kasprintf(GFP_KERNEL, "%s%s/fs/", HTTP_REQUEST_LINE,
+                           config->token);
+  http->queries = mempool_create_slab_pool(HTTP_MIN_QUERY_BUFFERS,
+                                           networkfs_query_cachep);
+  if (http->token == NULL || http->prefix == NULL || http->queries == NULL) {
+    mempool_destroy(http->queries);
+    kfree(http->prefix);
+    kfree(http->token);
+    kfree(http);
+    return ERR_PTR(-ENOMEM);
+  }
+  http->prefix_size = strlen(http->prefix);
+
+  http->transport.ops = &networkfs_http_transport_ops;
+  networkfs_pool_init(&http->pool, &config->addr);
+  mutex_init(&http->watch_lock);
+
+  http->v2 = networkfs_v2_connect(&config->addr, http->token);
+  if (IS_ERR(http->v2)) {
+    pr_info("networkfs: binary protocol is unavailable, using HTTP\n");
+    http->v2 = NULL;
+  }
+
+  return &http->transport;
+}
+
+int networkfs_http_init(void) {
+  networkfs_connection_cachep =
+      KMEM_CACHE(networkfs_connection, SLAB_RECLAIM_ACCOUNT);
+  if (networkfs_connection_cachep == NULL) {
+    return -ENOMEM;
+  }
+  networkfs_query_cachep = kmem_cache_create(
+      "networkfs_query", HTTP_QUERY_BUFFER_SIZE, 0, 0, NULL);
+  if (networkfs_query_cachep == NULL) {
+    kmem_cache_destroy(networkfs_connection_cachep);
+    return -ENOMEM;
+  }
+  return 0;
+}
+
+void networkfs_http_exit(void) {
+  kmem_cache_destroy(networkfs_query_cachep);
+  kmem_cache_destroy(networkfs_connection_cachep);
 }
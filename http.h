@@ -1,7 +1,13 @@
 #ifndef NETWORKFS_HTTP
 #define NETWORKFS_HTTP
 
+#include <linux/in.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
 #include <linux/types.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #define ESOCKNOCREATE 0x2001
 #define ESOCKNOCONNECT 0x2002
@@ -11,26 +17,104 @@
 #define EHTTPMALFORMED 0x2006
 #define EPROTMALFORMED 0x2007
 
+// Requests that may wait for responses on one connection
+#define NETWORKFS_PIPELINE_DEPTH 16
+// Connections opened per mount before requests queue on busy ones
+#define NETWORKFS_POOL_MAX_CONNECTIONS 4
+// Idle connections older than this are closed by the reaper
+#define NETWORKFS_POOL_IDLE_TIMEOUT (10 * HZ)
+#define NETWORKFS_POOL_REAP_INTERVAL (5 * HZ)
+// Attempts for a request whose connection was closed by the server
+#define NETWORKFS_CALL_ATTEMPTS 3
+// Sends and receives on a pooled connection fail after this long. Outlasts
+// the longest long-poll call.
+#define NETWORKFS_SOCKET_TIMEOUT (60 * HZ)
+// Room for the status line, one header or chunk line at a time
+#define NETWORKFS_SCRATCH_SIZE 1024
+
 /**
- * networkfs_http_call - make a call to networkfs API.
- * @token:           Unique filesystem token.
- * @method:          API method name, e.g. "list" for fs.list.
- * @response_buffer: Pointer to memory space for writing the response.
- *                   There should be available at least @buffer_size bytes.
- * @arg_size:        Number of arguments provided.
- * @...:             Exactly twice of @arg_size string arguments in format
- *                   key1, value1, key2, value2, ...
+ * struct networkfs_connection - pipelined HTTP/1.1 connection.
+ * @list:        Entry in the pool.
+ * @sock:        Connected socket.
+ * @last_used:   Time of the last completed request, in jiffies.
+ * @inflight:    Requests acquired this connection and not released it yet.
+ *               Protected by the pool lock.
+ * @send_lock:   Serializes senders, so requests go out back to back.
+ * @next_ticket: Sequence number of the next request sent.
+ * @serving:     Sequence number of the request whose response is next.
+ * @error:       Zero while the connection is usable, otherwise the error
+ *               reported to every request waiting on it.
+ * @waiters:     Requests waiting for their turn to read the response.
+ * @scratch:     Bytes received but not parsed yet: framing of the current
+ *               response and possibly the start of the next one.
+ * @scratch_start: Offset of the first unparsed byte in @scratch.
+ * @scratch_end: Offset past the last received byte in @scratch.
  *
- * This method makes an HTTP call to networkfs API server and parses the result.
+ * Responses arrive in the order the requests were sent, so every sender takes
+ * a ticket and waits until @serving reaches it. The waiter then reads its own
+ * response straight from the socket and passes the turn to the next one.
+ * Only the reader of the current response touches @scratch.
+ */
+struct networkfs_connection {
+  struct list_head list;
+  struct socket *sock;
+  unsigned long last_used;
+  unsigned int inflight;
+
+  struct mutex send_lock;
+  u64 next_ticket;
+  u64 serving;
+  int error;
+  wait_queue_head_t waiters;
+
+  char scratch[NETWORKFS_SCRATCH_SIZE];
+  size_t scratch_start;
+  size_t scratch_end;
+};
+
+/**
+ * struct networkfs_connection_pool - persistent HTTP/1.1 connections.
+ * @addr:        API server address.
+ * @lock:        Protects @connections, @count and connection counters.
+ * @connections: Open connections, including broken ones still in use.
+ * @count:       Number of connections in @connections.
+ * @pipelining:  Cleared once the server closes a pooled connection after its
+ *               first response; then every request gets a connection of its
+ *               own. Set again by a first response keeping one alive.
+ * @reaper:      Periodically closes connections idle for too long.
+ */
+struct networkfs_connection_pool {
+  struct sockaddr_in addr;
+  spinlock_t lock;
+  struct list_head connections;
+  size_t count;
+  bool pipelining;
+  struct delayed_work reaper;
+};
+
+/**
+ * networkfs_socket_connect - open a TCP connection to the API server.
+ * @addr: API server address.
+ * @sock: Where to store the connected socket.
+ *
+ * Sends and receives on the socket fail with -EAGAIN after
+ * NETWORKFS_SOCKET_TIMEOUT without progress.
  *
- * Return:
- * * If HTTP session succeeds, returns `result->status`.
- *   `result->response` is written into @response_buffer.
- * * Otherwise, returns negated errno, either defined in `errno-base.h`
- *   or in `http.h`, and @response_buffer stays unaltered.
+ * Return: 0 on success, otherwise negated error from `http.h`.
+ */
+int networkfs_socket_connect(const struct sockaddr_in *addr,
+                             struct socket **sock);
+
+void networkfs_pool_init(struct networkfs_connection_pool *pool,
+                         const struct sockaddr_in *addr);
+
+// Points @vec to @length bytes at @base, which must outlive the send
+void fill_vec(struct kvec *vec, const char *base, size_t length);
+
+/**
+ * networkfs_pool_destroy - close all connections of the pool.
+ * @pool: Pool to destroy. No calls may be in progress.
  */
-int64_t networkfs_http_call(const char *token, const char *method,
-                            char *response_buffer, size_t buffer_size,
-                            size_t arg_size, ...);
+void networkfs_pool_destroy(struct networkfs_connection_pool *pool);
 
 #endif
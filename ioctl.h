@@ -0,0 +1,25 @@
+#ifndef NETWORKFS_IOCTL
+#define NETWORKFS_IOCTL
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/**
+ * struct networkfs_resolve_args - argument of NETWORKFS_IOC_RESOLVE.
+ * @path:        User pointer to a path relative to the directory, with
+ *               components separated by '/'.
+ * @path_length: Length of @path, without terminator.
+ * @resolved:    Set to the number of leading components found. Only the
+ *               first 16 components are resolved.
+ */
+struct networkfs_resolve_args {
+  __u64 path;
+  __u32 path_length;
+  __u32 resolved;
+};
+
+// Looks up all components of a path in one round trip and caches their
+// dentries. Issued on an open directory of the mount.
+#define NETWORKFS_IOC_RESOLVE _IOWR('N', 1, struct networkfs_resolve_args)
+
+#endif
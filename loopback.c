@@ -0,0 +1,839 @@
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/hashtable.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/stringhash.h>
+#include <linux/xarray.h>
+
+#include "compound.h"
+#include "http.h"
+#include "models.h"
+#include "transport.h"
+
+#define LOOPBACK_ROOT_INO 1000
+#define LOOPBACK_MAX_CONTENT sizeof(((struct content *)0)->content)
+#define LOOPBACK_MAX_NAME (sizeof(((struct entry *)0)->name) - 1)
+#define LOOPBACK_MAX_DELTA ARRAY_SIZE(((struct entries_delta *)0)->changes)
+#define LOOPBACK_MAX_RESOLVE \
+  ARRAY_SIZE(((struct resolved_path *)0)->components)
+#define LOOPBACK_MAX_COMPOUND \
+  ARRAY_SIZE(((struct compound_results *)0)->results)
+// Changes of entries remembered per directory for list_changes
+#define LOOPBACK_MAX_LOG 64
+// Buckets of the name table are shared by all directories of the tree
+#define LOOPBACK_NAME_BITS 10
+
+/*
+ * In-memory implementation of networkfs API. It behaves like the API server,
+ * so that VFS and caching overhead can be measured without any network.
+ */
+
+struct loopback_node {
+  ino_t ino;
+  unsigned char entry_type;
+  unsigned int links;  // number of entries referring to the node
+  u64 change;          // change attribute, see loopback_touch()
+  // DT_DIR
+  struct list_head children;
+  size_t children_count;
+  struct list_head log;  // recent changes of children, oldest first
+  size_t log_count;
+  u64 log_floor;  // every change after this attribute is in @log
+  // DT_REG
+  size_t size;
+  char content[LOOPBACK_MAX_CONTENT];
+};
+
+struct loopback_entry {
+  struct list_head list;        // in children of @parent, in listing order
+  struct hlist_node name_node;  // in names of the transport
+  struct loopback_node *parent;
+  struct loopback_node *node;
+  char name[LOOPBACK_MAX_NAME + 1];
+};
+
+struct loopback_change {
+  struct list_head list;
+  u64 change;  // attribute of the directory after the change
+  struct entry_change record;
+};
+
+struct networkfs_loopback_transport {
+  struct networkfs_transport transport;
+  struct mutex lock;  // protects the whole tree
+  struct xarray nodes;
+  u64 change_seq;  // last change attribute given out
+  // Entries of every directory, hashed by parent and name
+  DECLARE_HASHTABLE(names, LOOPBACK_NAME_BITS);
+};
+
+#define LOOPBACK_TRANSPORT(t) \
+  container_of(t, struct networkfs_loopback_transport, transport)
+
+typedef int64_t (*loopback_handler)(struct networkfs_loopback_transport *lo,
+                                    struct networkfs_call *call);
+
+int64_t loopback_respond(struct networkfs_call *call, const void *response,
+                         size_t size) {
+  call->response_size = size;
+  if (size > call->buffer_size) {
+    return -ENOSPC;
+  }
+  memcpy(call->response_buffer, response, size);
+  return NETWORKFS_OK;
+}
+
+// Records a change of entries or content of @node. Attributes come from one
+// counter, so they never repeat even for reused inode numbers.
+void loopback_touch(struct networkfs_loopback_transport *lo,
+                    struct loopback_node *node) {
+  node->change = ++lo->change_seq;
+}
+
+struct loopback_node *loopback_node_create(
+    struct networkfs_loopback_transport *lo, unsigned char entry_type) {
+  struct loopback_node *node;
+  u32 ino;
+
+  node = kzalloc(sizeof(struct loopback_node), GFP_KERNEL);
+  if (node == NULL) {
+    return NULL;
+  }
+  node->entry_type = entry_type;
+  INIT_LIST_HEAD(&node->children);
+  INIT_LIST_HEAD(&node->log);
+
+  if (xa_alloc(&lo->nodes, &ino, node, XA_LIMIT(LOOPBACK_ROOT_INO, U32_MAX),
+               GFP_KERNEL) != 0) {
+    kfree(node);
+    return NULL;
+  }
+  node->ino = ino;
+  loopback_touch(lo, node);
+  node->log_floor = node->change;
+
+  return node;
+}
+
+void loopback_log_clear(struct loopback_node *dir) {
+  struct loopback_change *record, *tmp;
+
+  list_for_each_entry_safe(record, tmp, &dir->log, list) { kfree(record); }
+  INIT_LIST_HEAD(&dir->log);
+  dir->log_count = 0;
+  dir->log_floor = dir->change;
+}
+
+// Remembers that @entry was added to or removed from @dir, which was just
+// touched. Only the latest LOOPBACK_MAX_LOG changes are kept.
+void loopback_log(struct loopback_node *dir, const struct loopback_entry *entry,
+                  bool removed) {
+  struct loopback_change *record =
+      kzalloc(sizeof(struct loopback_change), GFP_KERNEL);
+  if (record == NULL) {
+    // Clients fall back to a full listing
+    loopback_log_clear(dir);
+    return;
+  }
+
+  if (dir->log_count == LOOPBACK_MAX_LOG) {
+    struct loopback_change *oldest =
+        list_first_entry(&dir->log, struct loopback_change, list);
+    dir->log_floor = oldest->change;
+    list_del(&oldest->list);
+    kfree(oldest);
+    --dir->log_count;
+  }
+
+  record->change = dir->change;
+  record->record.removed = removed;
+  record->record.entry.entry_type = entry->node->entry_type;
+  record->record.entry.ino = entry->node->ino;
+  strscpy(record->record.entry.name, entry->name,
+          sizeof(record->record.entry.name));
+  list_add_tail(&record->list, &dir->log);
+  ++dir->log_count;
+}
+
+void loopback_node_free(struct networkfs_loopback_transport *lo,
+                        struct loopback_node *node) {
+  xa_erase(&lo->nodes, node->ino);
+  loopback_log_clear(node);
+  kfree(node);
+}
+
+void loopback_node_put(struct networkfs_loopback_transport *lo,
+                       struct loopback_node *node) {
+  if (--node->links == 0) {
+    loopback_node_free(lo, node);
+  }
+}
+
+// Finds inode given by argument @key, checking its type if @type is nonzero
+int64_t loopback_get_node(struct networkfs_loopback_transport *lo,
+                          struct networkfs_call *call, const char *key,
+                          unsigned char type, struct loopback_node **node) {
+  const char *value = networkfs_call_arg(call, key);
+  unsigned long ino;
+
+  if (value == NULL || kstrtoul(value, 10, &ino) != 0) {
+    return -EINVAL;
+  }
+
+  *node = xa_load(&lo->nodes, ino);
+  if (*node == NULL) {
+    return NETWORKFS_ENOENT;
+  }
+  if (type == DT_DIR && (*node)->entry_type != DT_DIR) {
+    return NETWORKFS_ENOTDIR;
+  }
+  if (type == DT_REG && (*node)->entry_type != DT_REG) {
+    return NETWORKFS_ENOTFILE;
+  }
+
+  return NETWORKFS_OK;
+}
+
+// Parent salts the hash, so equal names in different directories spread
+unsigned int loopback_name_hash(const struct loopback_node *dir,
+                                const char *name) {
+  return full_name_hash(dir, name, strlen(name));
+}
+
+struct loopback_entry *loopback_find(struct networkfs_loopback_transport *lo,
+                                     struct loopback_node *dir,
+                                     const char *name) {
+  struct loopback_entry *entry;
+
+  hash_for_each_possible(lo->names, entry, name_node,
+                         loopback_name_hash(dir, name)) {
+    if (entry->parent == dir && strcmp(entry->name, name) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// Adds @node to directory given by "parent" under name given by "name"
+int64_t loopback_add_entry(struct networkfs_loopback_transport *lo,
+                           struct networkfs_call *call,
+                           struct loopback_node *node) {
+  struct loopback_node *parent;
+  const char *name = networkfs_call_arg(call, "name");
+
+  int64_t ret = loopback_get_node(lo, call, "parent", DT_DIR, &parent);
+  if (ret != NETWORKFS_OK) {
+    return ret;
+  }
+  if (name == NULL) {
+    return -EINVAL;
+  }
+  if (strlen(name) > LOOPBACK_MAX_NAME) {
+    return NETWORKFS_ENAMETOOLONG;
+  }
+  if (loopback_find(lo, parent, name) != NULL) {
+    return NETWORKFS_EEXIST;
+  }
+
+  struct loopback_entry *entry =
+      kzalloc(sizeof(struct loopback_entry), GFP_KERNEL);
+  if (entry == NULL) {
+    return -ENOMEM;
+  }
+  strscpy(entry->name, name, sizeof(entry->name));
+  entry->parent = parent;
+  entry->node = node;
+  ++node->links;
+  list_add_tail(&entry->list, &parent->children);
+  hash_add(lo->names, &entry->name_node, loopback_name_hash(parent, name));
+  ++parent->children_count;
+  loopback_touch(lo, parent);
+  loopback_log(parent, entry, false);
+
+  return NETWORKFS_OK;
+}
+
+int64_t loopback_lookup(struct networkfs_loopback_transport *lo,
+                        struct networkfs_call *call) {
+  struct loopback_node *parent;
+  struct loopback_entry *entry;
+  const char *name = networkfs_call_arg(call, "name");
+
+  int64_t ret = loopback_get_node(lo, call, "parent", DT_DIR, &parent);
+  if (ret != NETWORKFS_OK) {
+    return ret;
+  }
+  if (name == NULL) {
+    return -EINVAL;
+  }
+
+  entry = loopback_find(lo, parent, name);
+  if (entry == NULL) {
+    return NETWORKFS_ENOENT_DIR;
+  }
+
+  struct entry_info info = {.entry_type = entry->node->entry_type,
+                            .ino = entry->node->ino,
+                            .change = entry->node->change,
+                            .size = entry->node->size};
+  return loopback_respond(call, &info, sizeof(info));
+}
+
+int64_t loopback_resolve(struct networkfs_loopback_transport *lo,
+                         struct networkfs_call *call) {
+  struct loopback_node *dir;
+  struct resolved_path resolved = {};
+  const char *path = networkfs_call_arg(call, "path");
+  char *name;
+
+  int64_t ret = loopback_get_node(lo, call, "parent", DT_DIR, &dir);
+  if (ret != NETWORKFS_OK) {
+    return ret;
+  }
+  if (path == NULL) {
+    return -EINVAL;
+  }
+
+  char *copy = kstrdup(path, GFP_KERNEL);
+  if (copy == NULL) {
+    return -ENOMEM;
+  }
+  char *cursor = copy;
+  while ((name = strsep(&cursor, "/")) != NULL && dir != NULL &&
+         resolved.components_count < LOOPBACK_MAX_RESOLVE) {
+    if (*name == '\0') {
+      continue;
+    }
+    struct loopback_entry *entry = loopback_find(lo, dir, name);
+    if (entry == NULL) {
+      break;
+    }
+    resolved.components[resolved.components_count++] =
+        (struct entry_info){.entry_type = entry->node->entry_type,
+                            .ino = entry->node->ino,
+                            .change = entry->node->change,
+                            .size = entry->node->size};
+    // Files have nothing below them
+    dir = entry->node->entry_type == DT_DIR ? entry->node : NULL;
+  }
+  kfree(copy);
+
+  return loopback_respond(call, &resolved, sizeof(resolved));
+}
+
+int64_t loopback_getattr(struct networkfs_loopback_transport *lo,
+                         struct networkfs_call *call) {
+  struct loopback_node *node;
+
+  int64_t ret = loopback_get_node(lo, call, "inode", 0, &node);
+  if (ret != NETWORKFS_OK) {
+    return ret;
+  }
+
+  struct attr_info info = {.entry_type = node->entry_type,
+                           .ino = node->ino,
+                           .change = node->change,
+                           .size = node->size};
+  return loopback_respond(call, &info, sizeof(info));
+}
+
+// Copies @count children of @dir, skipping the first @skip of them
+void loopback_copy_entries(struct loopback_node *dir, struct entries *entries,
+                           size_t skip, size_t count) {
+  struct loopback_entry *child;
+  struct entry *entry = entries->entries;
+
+  entries->entries_count = count;
+  list_for_each_entry(child, &dir->children, list) {
+    if (count == 0) {
+      break;
+    } else if (skip > 0) {
+      --skip;
+      continue;
+    }
+    entry->entry_type = child->node->entry_type;
+    entry->ino = child->node->ino;
+    strscpy(entry->name, child->name, sizeof(entry->name));
+    ++entry;
+    --count;
+  }
+}
+
+int64_t loopback_list(struct networkfs_loopback_transport *lo,
+                      struct networkfs_call *call) {
+  struct loopback_node *dir;
+
+  int64_t ret = loopback_get_node(lo, call, "inode", DT_DIR, &dir);
+  if (ret != NETWORKFS_OK) {
+    return ret;
+  }
+
+  size_t size = offsetof(struct entries, entries) +
+                dir->children_count * sizeof(struct entry);
+  call->response_size = size;
+  if (size > call->buffer_size) {
+    return -ENOSPC;
+  }
+
+  loopback_copy_entries(dir, (struct entries *)call->response_buffer, 0,
+                        dir->children_count);
+  return NETWORKFS_OK;
+}
+
+int64_t loopback_list_page(struct networkfs_loopback_transport *lo,
+                           struct networkfs_call *call) {
+  const char *cursor_value = networkfs_call_arg(call, "cursor");
+  const char *limit_value = networkfs_call_arg(call, "limit");
+  struct loopback_node *dir;
+  unsigned long cursor, limit;
+
+  int64_t ret = loopback_get_node(lo, call, "inode", DT_DIR, &dir);
+  if (ret != NETWORKFS_OK) {
+    return ret;
+  }
+  if (cursor_value == NULL || kstrtoul(cursor_value, 10, &cursor) != 0 ||
+      limit_value == NULL || kstrtoul(limit_value, 10, &limit) != 0) {
+    return -EINVAL;
+  }
+
+  // Cursor is just the number of children already listed
+  size_t count = cursor < dir->children_count
+                     ? min(dir->children_count - cursor, limit)
+                     : 0;
+  size_t size = offsetof(struct entries_page, entries.entries) +
+                count * sizeof(struct entry);
+  call->response_size = size;
+  if (size > call->buffer_size) {
+    return -ENOSPC;
+  }
+
+  struct entries_page *page = (struct entries_page *)call->response_buffer;
+  loopback_copy_entries(dir, &page->entries, cursor, count);
+  page->next_cursor =
+      cursor + count < dir->children_count ? cursor + count : 0;
+  page->change = dir->change;
+  return NETWORKFS_OK;
+}
+
+int64_t loopback_list_changes(struct networkfs_loopback_transport *lo,
+                              struct networkfs_call *call) {
+  const char *since_value = networkfs_call_arg(call, "since");
+  struct loopback_change *record, *last = NULL;
+  struct loopback_node *dir;
+  unsigned long long since;
+  size_t count = 0;
+  bool more = false;
+
+  int64_t ret = loopback_get_node(lo, call, "inode", DT_DIR, &dir);
+  if (ret != NETWORKFS_OK) {
+    return ret;
+  }
+  if (since_value == NULL || kstrtoull(since_value, 10, &since) != 0) {
+    return -EINVAL;
+  }
+  if (since < dir->log_floor) {
+    return NETWORKFS_ETRUNCATED;
+  }
+
+  list_for_each_entry(record, &dir->log, list) {
+    if (record->change <= since) {
+      continue;
+    } else if (count == LOOPBACK_MAX_DELTA) {
+      more = true;
+      break;
+    }
+    ++count;
+    last = record;
+  }
+
+  size_t size = offsetof(struct entries_delta, changes) +
+                count * sizeof(struct entry_change);
+  call->response_size = size;
+  if (size > call->buffer_size) {
+    return -ENOSPC;
+  }
+
+  struct entries_delta *delta = (struct entries_delta *)call->response_buffer;
+  delta->changes_count = 0;
+  list_for_each_entry(record, &dir->log, list) {
+    if (delta->changes_count == count) {
+      break;
+    } else if (record->change > since) {
+      delta->changes[delta->changes_count++] = record->record;
+    }
+  }
+  delta->change = more ? last->change : dir->change;
+  delta->next_since = more ? last->change : 0;
+
+  return NETWORKFS_OK;
+}
+
+int64_t loopback_create(struct networkfs_loopback_transport *lo,
+                        struct networkfs_call *call) {
+  const char *type = networkfs_call_arg(call, "type");
+  unsigned char entry_type;
+
+  if (type != NULL && strcmp(type, "file") == 0) {
+    entry_type = DT_REG;
+  } else if (type != NULL && strcmp(type, "directory") == 0) {
+    entry_type = DT_DIR;
+  } else {
+    return -EINVAL;
+  }
+
+  struct loopback_node *node = loopback_node_create(lo, entry_type);
+  if (node == NULL) {
+    return -ENOMEM;
+  }
+
+  int64_t ret = loopback_add_entry(lo, call, node);
+  if (ret != NETWORKFS_OK) {
+    loopback_node_free(lo, node);
+    return ret;
+  }
+
+  struct create_info info = {.ino = node->ino};
+  return loopback_respond(call, &info, sizeof(info));
+}
+
+int64_t loopback_remove(struct networkfs_loopback_transport *lo,
+                        struct networkfs_call *call,
+                        unsigned char entry_type) {
+  struct loopback_node *parent;
+  struct loopback_entry *entry;
+  const char *name = networkfs_call_arg(call, "name");
+
+  int64_t ret = loopback_get_node(lo, call, "parent", DT_DIR, &parent);
+  if (ret != NETWORKFS_OK) {
+    return ret;
+  }
+  if (name == NULL) {
+    return -EINVAL;
+  }
+
+  entry = loopback_find(lo, parent, name);
+  if (entry == NULL) {
+    return NETWORKFS_ENOENT_DIR;
+  }
+  if (entry->node->entry_type != entry_type) {
+    return entry_type == DT_DIR ? NETWORKFS_ENOTDIR : NETWORKFS_ENOTFILE;
+  }
+  if (entry_type == DT_DIR && entry->node->children_count != 0) {
+    return NETWORKFS_ENOTEMPTY;
+  }
+
+  list_del(&entry->list);
+  hash_del(&entry->name_node);
+  --parent->children_count;
+  loopback_touch(lo, parent);
+  loopback_log(parent, entry, true);
+  loopback_node_put(lo, entry->node);
+  kfree(entry);
+
+  return NETWORKFS_OK;
+}
+
+int64_t loopback_unlink(struct networkfs_loopback_transport *lo,
+                        struct networkfs_call *call) {
+  return loopback_remove(lo, call, DT_REG);
+}
+
+int64_t loopback_rmdir(struct networkfs_loopback_transport *lo,
+                       struct networkfs_call *call) {
+  return loopback_remove(lo, call, DT_DIR);
+}
+
+int64_t loopback_read(struct networkfs_loopback_transport *lo,
+                      struct networkfs_call *call) {
+  struct loopback_node *node;
+
+  int64_t ret = loopback_get_node(lo, call, "inode", DT_REG, &node);
+  if (ret != NETWORKFS_OK) {
+    return ret;
+  }
+
+  if (call->conditional) {
+    // Change attribute of the file serves as its entity tag
+    snprintf(call->etag, NETWORKFS_ETAG_SIZE, "\"%llu\"", node->change);
+    if (call->if_none_match != NULL &&
+        strcmp(call->if_none_match, call->etag) == 0) {
+      return NETWORKFS_ENOTMODIFIED;
+    }
+  }
+
+  size_t size = offsetof(struct content, content) + node->size;
+  call->response_size = size;
+  if (size > call->buffer_size) {
+    return -ENOSPC;
+  }
+
+  struct content *content = (struct content *)call->response_buffer;
+  content->content_length = node->size;
+  memcpy(content->content, node->content, node->size);
+
+  return NETWORKFS_OK;
+}
+
+int64_t loopback_write(struct networkfs_loopback_transport *lo,
+                       struct networkfs_call *call) {
+  struct loopback_node *node;
+  const char *content = networkfs_call_arg(call, "content");
+
+  int64_t ret = loopback_get_node(lo, call, "inode", DT_REG, &node);
+  if (ret != NETWORKFS_OK) {
+    return ret;
+  }
+  if (content == NULL) {
+    return -EINVAL;
+  }
+
+  size_t size = strlen(content);
+  if (size > LOOPBACK_MAX_CONTENT) {
+    return NETWORKFS_EFBIG;
+  }
+  memcpy(node->content, content, size);
+  node->size = size;
+  loopback_touch(lo, node);
+  if (call->conditional) {
+    snprintf(call->etag, NETWORKFS_ETAG_SIZE, "\"%llu\"", node->change);
+  }
+
+  return NETWORKFS_OK;
+}
+
+int64_t loopback_link(struct networkfs_loopback_transport *lo,
+                      struct networkfs_call *call) {
+  struct loopback_node *source;
+
+  int64_t ret = loopback_get_node(lo, call, "source", DT_REG, &source);
+  if (ret != NETWORKFS_OK) {
+    return ret;
+  }
+
+  return loopback_add_entry(lo, call, source);
+}
+
+// Writes a piece of the dump at @offset, or passes it to the consumer of a
+// streamed call
+int loopback_snapshot_emit(struct networkfs_call *call, size_t offset,
+                           const void *piece, size_t size) {
+  if (call->consume != NULL) {
+    return call->consume(call->consume_data, piece, size);
+  }
+  memcpy(call->response_buffer + offset, piece, size);
+  return 0;
+}
+
+// Walks every directory twice: to size the dump and to write it
+int64_t loopback_snapshot(struct networkfs_loopback_transport *lo,
+                          struct networkfs_call *call) {
+  struct tree_snapshot header = {};
+  struct loopback_node *dir;
+  struct loopback_entry *entry;
+  unsigned long ino;
+  char record[ALIGN(sizeof(struct tree_record) + LOOPBACK_MAX_NAME, 8)];
+
+  size_t size = sizeof(struct tree_snapshot);
+  xa_for_each(&lo->nodes, ino, dir) {
+    list_for_each_entry(entry, &dir->children, list) {
+      size = ALIGN(size + sizeof(struct tree_record) + strlen(entry->name), 8);
+      ++header.records_count;
+    }
+  }
+
+  call->response_size = size;
+  if (call->consume == NULL && size > call->buffer_size) {
+    return -ENOSPC;
+  }
+
+  int error = loopback_snapshot_emit(call, 0, &header,
+                                     sizeof(struct tree_snapshot));
+  size_t offset = sizeof(struct tree_snapshot);
+  xa_for_each(&lo->nodes, ino, dir) {
+    list_for_each_entry(entry, &dir->children, list) {
+      if (error != 0) {
+        return error;
+      }
+      struct tree_record item = {.parent = dir->ino,
+                                 .ino = entry->node->ino,
+                                 .entry_type = entry->node->entry_type,
+                                 .name_length = strlen(entry->name)};
+      size_t length = ALIGN(sizeof(struct tree_record) + item.name_length, 8);
+      memset(record, 0, length);
+      memcpy(record, &item, sizeof(struct tree_record));
+      memcpy(record + sizeof(struct tree_record), entry->name,
+             item.name_length);
+      error = loopback_snapshot_emit(call, offset, record, length);
+      offset += length;
+    }
+  }
+
+  return error != 0 ? error : NETWORKFS_OK;
+}
+
+int64_t loopback_compound(struct networkfs_loopback_transport *lo,
+                          struct networkfs_call *call);
+
+const struct {
+  const char *method;
+  loopback_handler handler;
+} LOOPBACK_METHODS[] = {
+    {"lookup", loopback_lookup},
+    {"list", loopback_list},
+    {"create", loopback_create},
+    {"unlink", loopback_unlink},
+    {"rmdir", loopback_rmdir},
+    {"read", loopback_read},
+    {"write", loopback_write},
+    {"link", loopback_link},
+    {"list_page", loopback_list_page},
+    {"getattr", loopback_getattr},
+    {"list_changes", loopback_list_changes},
+    {"snapshot", loopback_snapshot},
+    {"resolve", loopback_resolve},
+    {"compound", loopback_compound},
+};
+
+// Runs the handler of the method, like the server answering an unknown one
+// with 404. Called with the lock held.
+int64_t loopback_dispatch(struct networkfs_loopback_transport *lo,
+                          struct networkfs_call *call) {
+  call->response_size = 0;
+  for (int i = 0; i < ARRAY_SIZE(LOOPBACK_METHODS); i++) {
+    if (strcmp(LOOPBACK_METHODS[i].method, call->method) == 0) {
+      return LOOPBACK_METHODS[i].handler(lo, call);
+    }
+  }
+  return -EHTTPBADCODE;
+}
+
+// Operations a compound request may carry, see networkfs_compound_call()
+const char *LOOPBACK_COMPOUND_METHODS[] = {"lookup", "create", "unlink",
+                                           "rmdir", "link"};
+
+bool loopback_compoundable(const char *method) {
+  for (int i = 0; i < ARRAY_SIZE(LOOPBACK_COMPOUND_METHODS); i++) {
+    if (strcmp(LOOPBACK_COMPOUND_METHODS[i], method) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int64_t loopback_compound(struct networkfs_loopback_transport *lo,
+                          struct networkfs_call *call) {
+  const char *ops = networkfs_call_arg(call, "ops");
+  struct networkfs_call op;
+
+  if (ops == NULL) {
+    return -EINVAL;
+  }
+  char *copy = kstrdup(ops, GFP_KERNEL);
+  struct compound_results *results =
+      kzalloc(sizeof(struct compound_results), GFP_KERNEL);
+  if (copy == NULL || results == NULL) {
+    kfree(copy);
+    kfree(results);
+    return -ENOMEM;
+  }
+
+  char *cursor = copy;
+  int64_t ret = NETWORKFS_OK;
+  while (results->results_count < LOOPBACK_MAX_COMPOUND) {
+    struct compound_result *result =
+        &results->results[results->results_count];
+    networkfs_call_init(&op, NULL, (char *)&result->response,
+                        sizeof(result->response), 0);
+    int parsed = networkfs_compound_parse(&cursor, &op);
+    if (parsed <= 0) {
+      ret = parsed;
+      break;
+    }
+    if (!loopback_compoundable(op.method)) {
+      ret = -EINVAL;
+      break;
+    }
+
+    int64_t status = loopback_dispatch(lo, &op);
+    if (status < 0) {
+      // Unknown operation must not look like a missing compound method
+      ret = status == -EHTTPBADCODE ? -EINVAL : status;
+      break;
+    }
+    result->status = status;
+    ++results->results_count;
+  }
+
+  if (ret == NETWORKFS_OK) {
+    ret = loopback_respond(call, results, sizeof(struct compound_results));
+  }
+  kfree(copy);
+  kfree(results);
+  return ret;
+}
+
+int64_t networkfs_loopback_call(struct networkfs_transport *transport,
+                                struct networkfs_call *call) {
+  struct networkfs_loopback_transport *lo = LOOPBACK_TRANSPORT(transport);
+
+  mutex_lock(&lo->lock);
+  int64_t ret = loopback_dispatch(lo, call);
+  mutex_unlock(&lo->lock);
+
+  return ret;
+}
+
+int networkfs_loopback_call_async(struct networkfs_transport *transport,
+                                  struct networkfs_call *call) {
+  networkfs_call_complete(call, networkfs_loopback_call(transport, call));
+  return 0;
+}
+
+void networkfs_loopback_teardown(struct networkfs_transport *transport) {
+  struct networkfs_loopback_transport *lo = LOOPBACK_TRANSPORT(transport);
+  struct loopback_node *node;
+  struct loopback_entry *entry, *tmp;
+  unsigned long ino;
+
+  xa_for_each(&lo->nodes, ino, node) {
+    list_for_each_entry_safe(entry, tmp, &node->children, list) {
+      kfree(entry);
+    }
+    loopback_log_clear(node);
+    kfree(node);
+  }
+  xa_destroy(&lo->nodes);
+  kfree(lo);
+}
+
+const struct networkfs_transport_ops networkfs_loopback_transport_ops = {
+    .call = networkfs_loopback_call,
+    .call_async = networkfs_loopback_call_async,
+    .teardown = networkfs_loopback_teardown};
+
+struct networkfs_transport *networkfs_loopback_transport_create(
+    const struct networkfs_transport_config *config) {
+  struct networkfs_loopback_transport *lo =
+      kzalloc(sizeof(struct networkfs_loopback_transport), GFP_KERNEL);
+  if (lo == NULL) {
+    return ERR_PTR(-ENOMEM);
+  }
+
+  lo->transport.ops = &networkfs_loopback_transport_ops;
+  mutex_init(&lo->lock);
+  hash_init(lo->names);
+  xa_init_flags(&lo->nodes, XA_FLAGS_ALLOC);
+
+  struct loopback_node *root = loopback_node_create(lo, DT_DIR);
+  if (root == NULL) {
+    kfree(lo);
+    return ERR_PTR(-ENOMEM);
+  }
+  root->links = 1;
+
+  return &lo->transport;
+}
@@ -1,3 +1,6 @@
+#ifndef NETWORKFS_MODELS
+#define NETWORKFS_MODELS
+
 struct entry {
   unsigned char entry_type;  // DT_DIR (4) or DT_REG (8)
   ino_t ino;
@@ -9,11 +12,124 @@ struct entries {
   struct entry entries[16];
 };
 
+// Part of a listing returned by list_page
+struct entries_page {
+  uint64_t next_cursor;  // cursor of the next page, 0 after the last one
+  uint64_t change;       // change attribute of the directory
+  struct entries entries;
+};
+
+// Change attribute grows on every change of an inode: entries of a directory
+// or content of a file. Zero means that the server does not track changes.
+
+struct entry_change {
+  unsigned char removed;  // 1 if the entry was removed, 0 if added
+  struct entry entry;
+};
+
+// Changes of directory entries returned by list_changes
+struct entries_delta {
+  uint64_t change;      // change attribute reached after these changes
+  uint64_t next_since;  // since for the next call, 0 if up to date
+  size_t changes_count;
+  struct entry_change changes[16];
+};
+
+// Kinds of events pushed by watch
+enum networkfs_watch_kind {
+  NETWORKFS_WATCH_CHANGED = 0,  // content of file ino changed
+  NETWORKFS_WATCH_ADDED = 1,    // entry was added to directory ino
+  NETWORKFS_WATCH_REMOVED = 2   // entry was removed from directory ino
+};
+
+struct watch_event {
+  unsigned char kind;
+  ino_t ino;
+  struct entry entry;  // unused for NETWORKFS_WATCH_CHANGED
+};
+
+// Events returned by watch, oldest first. The server holds the call until
+// something happens after since or the timeout passes.
+struct watch_events {
+  uint64_t next_since;  // since for the next call
+  size_t events_count;
+  struct watch_event events[16];
+};
+
+// Metadata of the whole tree returned by snapshot: the header followed by
+// records_count records. Name of the entry, not terminated, follows every
+// record, and the next record starts at a multiple of 8 bytes.
+struct tree_snapshot {
+  uint64_t records_count;
+};
+
+struct tree_record {
+  ino_t parent;
+  ino_t ino;
+  unsigned char entry_type;  // DT_DIR (4) or DT_REG (8)
+  unsigned char name_length;
+};
+
 struct entry_info {
   unsigned char entry_type;  // DT_DIR (4) or DT_REG (8)
   ino_t ino;
+  uint64_t change;  // change attribute of the entry, absent in old servers
+  uint64_t size;    // content length of a file, absent in old servers
+};
+
+// Components of a path returned by resolve, in order. Resolution stops at
+// the first missing component or at a file.
+struct resolved_path {
+  size_t components_count;
+  struct entry_info components[16];
+};
+
+struct attr_info {
+  unsigned char entry_type;  // DT_DIR (4) or DT_REG (8)
+  ino_t ino;
+  uint64_t change;
+  uint64_t size;  // content length of a file
 };
 
 struct create_info {
   ino_t ino;
 };
+
+struct content {
+  uint64_t content_length;
+  char content[512];
+};
+
+// Outcome of one operation of compound
+struct compound_result {
+  uint64_t status;
+  union {
+    struct entry_info lookup;
+    struct create_info create;
+  } response;  // unused by operations without response
+};
+
+// Results returned by compound, in the order of the operations. Operations
+// are independent: each one runs whatever the others returned.
+struct compound_results {
+  size_t results_count;
+  struct compound_result results[16];
+};
+
+// Statuses reported by networkfs API
+enum networkfs_status {
+  NETWORKFS_OK = 0,
+  NETWORKFS_ENOENT = 1,        // no inode with such number
+  NETWORKFS_ENOTFILE = 2,      // inode is not a regular file
+  NETWORKFS_ENOTDIR = 3,       // inode is not a directory
+  NETWORKFS_ENOENT_DIR = 4,    // no entry with such name in directory
+  NETWORKFS_EEXIST = 5,        // entry with such name already exists
+  NETWORKFS_EFBIG = 6,         // file content is too long
+  NETWORKFS_EDIRFULL = 7,      // directory has too many entries
+  NETWORKFS_ENOTEMPTY = 8,     // directory is not empty
+  NETWORKFS_ENAMETOOLONG = 9,  // entry name is too long
+  NETWORKFS_ETRUNCATED = 10,   // change log no longer reaches since
+  NETWORKFS_ENOTMODIFIED = 11  // response still matches If-None-Match
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "singleflight.h"
+
+#include <linux/atomic.h>
+#include <linux/completion.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/string.h>
+
+// Call in progress, on the stack of the caller making it
+struct networkfs_flight {
+  struct hlist_node node;
+  u32 hash;
+  struct networkfs_call *call;  // response is copied from here
+  int64_t result;
+  atomic_t followers;           // callers waiting for @result
+  struct completion done;       // @result is set
+  struct completion released;   // the last follower copied the response
+};
+
+int networkfs_singleflight_init(struct networkfs_singleflight *table) {
+  for (int i = 0; i < ARRAY_SIZE(table->buckets); i++) {
+    spin_lock_init(&table->buckets[i].lock);
+    INIT_HLIST_HEAD(&table->buckets[i].flights);
+  }
+
+  int error = percpu_counter_init(&table->calls, 0, GFP_KERNEL);
+  if (error != 0) {
+    return error;
+  }
+  error = percpu_counter_init(&table->coalesced, 0, GFP_KERNEL);
+  if (error != 0) {
+    percpu_counter_destroy(&table->calls);
+  }
+  return error;
+}
+
+void networkfs_singleflight_destroy(struct networkfs_singleflight *table) {
+  percpu_counter_destroy(&table->calls);
+  percpu_counter_destroy(&table->coalesced);
+}
+
+u32 networkfs_singleflight_hash(const struct networkfs_call *call) {
+  u32 hash = jhash(call->method, strlen(call->method), 0);
+  for (int i = 0; i < 2 * call->arg_size; i++) {
+    hash = jhash(call->args[i], strlen(call->args[i]), hash);
+  }
+  return hash;
+}
+
+bool networkfs_singleflight_same(const struct networkfs_call *a,
+                                 const struct networkfs_call *b) {
+  if (a->buffer_size != b->buffer_size || a->arg_size != b->arg_size ||
+      strcmp(a->method, b->method) != 0) {
+    return false;
+  }
+  for (int i = 0; i < 2 * a->arg_size; i++) {
+    if (strcmp(a->args[i], b->args[i]) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Waits for @flight and copies its response into @call
+int64_t networkfs_singleflight_follow(struct networkfs_flight *flight,
+                                      struct networkfs_call *call) {
+  wait_for_completion(&flight->done);
+
+  int64_t ret = flight->result;
+  if (ret >= 0) {
+    call->response_size = flight->call->response_size;
+    memcpy(call->response_buffer, flight->call->response_buffer,
+           min(call->response_size, call->buffer_size));
+    strscpy(call->etag, flight->call->etag, NETWORKFS_ETAG_SIZE);
+  }
+
+  if (atomic_dec_and_test(&flight->followers)) {
+    complete(&flight->released);
+  }
+  return ret;
+}
+
+int64_t networkfs_singleflight_call(struct networkfs_singleflight *table,
+                                    struct networkfs_call *call,
+                                    networkfs_singleflight_fn fn, void *data) {
+  struct networkfs_flight *flight;
+
+  if (call->conditional) {
+    // Entity tags of callers differ, so responses cannot be shared
+    return fn(data, call);
+  }
+
+  u32 hash = networkfs_singleflight_hash(call);
+  struct networkfs_singleflight_bucket *bucket =
+      &table->buckets[hash_32(hash, NETWORKFS_SINGLEFLIGHT_BITS)];
+
+  percpu_counter_inc(&table->calls);
+  spin_lock(&bucket->lock);
+  hlist_for_each_entry(flight, &bucket->flights, node) {
+    if (flight->hash == hash &&
+        networkfs_singleflight_same(flight->call, call)) {
+      atomic_inc(&flight->followers);
+      spin_unlock(&bucket->lock);
+      percpu_counter_inc(&table->coalesced);
+      return networkfs_singleflight_follow(flight, call);
+    }
+  }
+
+  struct networkfs_flight own = {.hash = hash, .call = call};
+  atomic_set(&own.followers, 0);
+  init_completion(&own.done);
+  init_completion(&own.released);
+  hlist_add_head(&own.node, &bucket->flights);
+  spin_unlock(&bucket->lock);
+
+  own.result = fn(data, call);
+
+  // Nobody joins once unhashed, so the followers counted here are all
+  spin_lock(&bucket->lock);
+  hlist_del(&own.node);
+  spin_unlock(&bucket->lock);
+  bool followed = atomic_read(&own.followers) > 0;
+
+  complete_all(&own.done);
+  if (followed) {
+    // Followers copy from our buffers, which have to outlive them
+    wait_for_completion(&own.released);
+  }
+  return own.result;
+}
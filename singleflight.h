@@ -0,0 +1,67 @@
+#ifndef NETWORKFS_SINGLEFLIGHT
+#define NETWORKFS_SINGLEFLIGHT
+
+#include <linux/list.h>
+#include <linux/percpu_counter.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "transport.h"
+
+// Calls in progress are hashed into 1 << NETWORKFS_SINGLEFLIGHT_BITS buckets
+#define NETWORKFS_SINGLEFLIGHT_BITS 6
+
+struct networkfs_singleflight_bucket {
+  spinlock_t lock;
+  struct hlist_head flights;
+};
+
+/**
+ * struct networkfs_singleflight - read-only calls in progress of a mount.
+ * @buckets:   Calls in progress by hash of their method and arguments. Each
+ *             bucket has its own lock, so unrelated calls do not contend.
+ * @calls:     Calls made through the table.
+ * @coalesced: Calls answered by an identical call already in progress.
+ */
+struct networkfs_singleflight {
+  struct networkfs_singleflight_bucket
+      buckets[1 << NETWORKFS_SINGLEFLIGHT_BITS];
+  struct percpu_counter calls;
+  struct percpu_counter coalesced;
+};
+
+/**
+ * typedef networkfs_singleflight_fn - makes the call on behalf of all
+ * callers sharing it.
+ *
+ * Return: the same as networkfs_transport_call().
+ */
+typedef int64_t (*networkfs_singleflight_fn)(void *data,
+                                             struct networkfs_call *call);
+
+/**
+ * networkfs_singleflight_init - set up empty table.
+ *
+ * Return: 0 on success, otherwise negated errno.
+ */
+int networkfs_singleflight_init(struct networkfs_singleflight *table);
+
+void networkfs_singleflight_destroy(struct networkfs_singleflight *table);
+
+/**
+ * networkfs_singleflight_call - make a read-only call once for all callers.
+ * @table: Table of the mount.
+ * @call:  Prepared call. Conditional calls are never shared.
+ * @fn:    Makes @call if no identical one is in progress.
+ * @data:  Passed to @fn.
+ *
+ * Calls with the same method, arguments and buffer size that are made while
+ * one of them is in progress wait for it and get a copy of its response.
+ *
+ * Return: the same as networkfs_transport_call().
+ */
+int64_t networkfs_singleflight_call(struct networkfs_singleflight *table,
+                                    struct networkfs_call *call,
+                                    networkfs_singleflight_fn fn, void *data);
+
+#endif
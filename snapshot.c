@@ -0,0 +1,218 @@
+#include "snapshot.h"
+
+#include <linux/align.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "http.h"
+#include "models.h"
+
+// Dump is parsed as it arrives, a record at a time. Record being received is
+// kept until its name is complete.
+struct networkfs_snapshot_parser {
+  struct networkfs_snapshot *snapshot;
+  bool has_header;
+  u64 records_left;
+  size_t padding;  // bytes to skip before the next record
+  size_t pending;  // bytes of the current record or header in @buffer
+  char buffer[sizeof(struct tree_record) + U8_MAX];
+};
+
+// Returns index of directory @ino, creating an empty one if needed
+struct networkfs_dir_index *networkfs_snapshot_dir_get(
+    struct networkfs_snapshot *snapshot, ino_t ino) {
+  struct networkfs_dir_index *index = xa_load(&snapshot->dirs, ino);
+  if (index != NULL) {
+    return index;
+  }
+
+  index = networkfs_dir_index_create(0);
+  if (index == NULL) {
+    return ERR_PTR(-ENOMEM);
+  }
+  int error = xa_err(xa_store(&snapshot->dirs, ino, index, GFP_KERNEL));
+  if (error != 0) {
+    networkfs_dir_index_free(index);
+    return ERR_PTR(error);
+  }
+  return index;
+}
+
+// Bytes of the header or of the record being received needed to take it,
+// 0 once all records are taken
+size_t networkfs_snapshot_needed(const struct networkfs_snapshot_parser *p) {
+  struct tree_record record;
+
+  if (!p->has_header) {
+    return sizeof(struct tree_snapshot);
+  } else if (p->records_left == 0) {
+    return 0;
+  } else if (p->pending < sizeof(struct tree_record)) {
+    return sizeof(struct tree_record);
+  }
+  memcpy(&record, p->buffer, sizeof(struct tree_record));
+  return sizeof(struct tree_record) + record.name_length;
+}
+
+// Takes the complete header or record held in the buffer
+int networkfs_snapshot_take(struct networkfs_snapshot_parser *p) {
+  struct tree_snapshot header;
+  struct tree_record record;
+  struct entry entry;
+
+  p->pending = 0;
+  if (!p->has_header) {
+    memcpy(&header, p->buffer, sizeof(struct tree_snapshot));
+    p->has_header = true;
+    p->records_left = header.records_count;
+    return 0;
+  }
+
+  memcpy(&record, p->buffer, sizeof(struct tree_record));
+  if (record.name_length == 0 ||
+      (record.entry_type != DT_DIR && record.entry_type != DT_REG)) {
+    return -EPROTMALFORMED;
+  }
+  entry.entry_type = record.entry_type;
+  entry.ino = record.ino;
+  memcpy(entry.name, p->buffer + sizeof(struct tree_record),
+         record.name_length);
+  entry.name[record.name_length] = '\0';
+
+  size_t length = sizeof(struct tree_record) + record.name_length;
+  p->padding = ALIGN(length, 8) - length;
+  --p->records_left;
+
+  struct networkfs_dir_index *dir =
+      networkfs_snapshot_dir_get(p->snapshot, record.parent);
+  if (IS_ERR(dir)) {
+    return PTR_ERR(dir);
+  }
+  int error = networkfs_dir_index_add(dir, &entry);
+  if (error != 0) {
+    return error;
+  }
+  ++p->snapshot->count;
+
+  // Empty directories are known to have no entries as well
+  if (record.entry_type == DT_DIR) {
+    dir = networkfs_snapshot_dir_get(p->snapshot, record.ino);
+    if (IS_ERR(dir)) {
+      return PTR_ERR(dir);
+    }
+  }
+  return 0;
+}
+
+// Consumes a piece of the dump as it is received. Bytes past the last record
+// are ignored.
+int networkfs_snapshot_consume(void *data, const char *piece, size_t size) {
+  struct networkfs_snapshot_parser *p = data;
+
+  while (size > 0) {
+    if (p->padding > 0) {
+      size_t length = min(p->padding, size);
+      p->padding -= length;
+      piece += length;
+      size -= length;
+      continue;
+    }
+
+    size_t needed = networkfs_snapshot_needed(p);
+    if (needed == 0) {
+      return 0;
+    }
+    size_t length = min(needed - p->pending, size);
+    memcpy(p->buffer + p->pending, piece, length);
+    p->pending += length;
+    piece += length;
+    size -= length;
+
+    if (p->pending == networkfs_snapshot_needed(p)) {
+      int error = networkfs_snapshot_take(p);
+      if (error != 0) {
+        return error;
+      }
+    }
+  }
+
+  return 0;
+}
+
+// Fetches the dump in one streamed call, indexing records as they arrive
+int networkfs_snapshot_fetch(struct networkfs_transport *transport,
+                             struct networkfs_snapshot *snapshot) {
+  struct networkfs_call call;
+
+  struct networkfs_snapshot_parser *parser =
+      kzalloc(sizeof(struct networkfs_snapshot_parser), GFP_KERNEL);
+  if (parser == NULL) {
+    return -ENOMEM;
+  }
+  parser->snapshot = snapshot;
+
+  networkfs_call_init(&call, "snapshot", NULL, 0, 0);
+  call.consume = networkfs_snapshot_consume;
+  call.consume_data = parser;
+  int64_t ret = networkfs_call_run(transport, &call);
+  if (ret == NETWORKFS_OK &&
+      (!parser->has_header || parser->records_left > 0)) {
+    ret = -EPROTMALFORMED;
+  }
+
+  kfree(parser);
+  // Server without snapshot support either rejects or fails the call
+  return ret > 0 || ret == -EHTTPBADCODE ? -EOPNOTSUPP : ret;
+}
+
+struct networkfs_snapshot *networkfs_snapshot_load(
+    struct networkfs_transport *transport, ino_t root) {
+  struct networkfs_dir_index *dir;
+  unsigned long ino;
+
+  struct networkfs_snapshot *snapshot =
+      kzalloc(sizeof(struct networkfs_snapshot), GFP_KERNEL);
+  if (snapshot == NULL) {
+    return ERR_PTR(-ENOMEM);
+  }
+  xa_init(&snapshot->dirs);
+
+  int error = networkfs_snapshot_fetch(transport, snapshot);
+  if (error != 0) {
+    goto free;
+  }
+
+  dir = networkfs_snapshot_dir_get(snapshot, root);
+  if (IS_ERR(dir)) {
+    error = PTR_ERR(dir);
+    goto free;
+  }
+  xa_for_each(&snapshot->dirs, ino, dir) {
+    error = networkfs_dir_index_seal(dir);
+    if (error != 0) {
+      goto free;
+    }
+  }
+
+  return snapshot;
+
+free:
+  networkfs_snapshot_free(snapshot);
+  return ERR_PTR(error);
+}
+
+struct networkfs_dir_index *networkfs_snapshot_dir(
+    const struct networkfs_snapshot *snapshot, ino_t ino) {
+  return xa_load((struct xarray *)&snapshot->dirs, ino);
+}
+
+void networkfs_snapshot_free(struct networkfs_snapshot *snapshot) {
+  struct networkfs_dir_index *dir;
+  unsigned long ino;
+
+  xa_for_each(&snapshot->dirs, ino, dir) { networkfs_dir_index_free(dir); }
+  xa_destroy(&snapshot->dirs);
+  kfree(snapshot);
+}
@@ -0,0 +1,43 @@
+#ifndef NETWORKFS_SNAPSHOT
+#define NETWORKFS_SNAPSHOT
+
+#include <linux/types.h>
+#include <linux/xarray.h>
+
+#include "dir_index.h"
+#include "transport.h"
+
+/**
+ * struct networkfs_snapshot - metadata of the whole tree fetched at once.
+ * @dirs:  Sealed &struct networkfs_dir_index of every directory, by inode
+ *         number.
+ * @count: Number of entries in the tree.
+ *
+ * Snapshot never changes, so it is read without locks.
+ */
+struct networkfs_snapshot {
+  struct xarray dirs;
+  size_t count;
+};
+
+/**
+ * networkfs_snapshot_load - fetch and index metadata of the whole tree.
+ * @transport: Transport of the mount.
+ * @root:      Inode number of the root directory.
+ *
+ * Return: new snapshot or ERR_PTR.
+ */
+struct networkfs_snapshot *networkfs_snapshot_load(
+    struct networkfs_transport *transport, ino_t root);
+
+/**
+ * networkfs_snapshot_dir - entries of a directory.
+ *
+ * Return: sealed index, or NULL if @ino is not a directory of the snapshot.
+ */
+struct networkfs_dir_index *networkfs_snapshot_dir(
+    const struct networkfs_snapshot *snapshot, ino_t ino);
+
+void networkfs_snapshot_free(struct networkfs_snapshot *snapshot);
+
+#endif
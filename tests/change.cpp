@@ -0,0 +1,84 @@
+#include <filesystem>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+/* Listing records the change attribute of the root, which the cached names
+ * are later revalidated against */
+class ChangeTest : public StandInTest {
+public:
+  ChangeTest() {
+    server.create("file", EntryType::FILE);
+    server.support("list_page");
+    server.support("getattr");
+  }
+
+protected:
+  std::string options() const override { return "lookup_ttl_ms=1,negative_ttl_ms=1"; }
+
+  void SetUp() override {
+    StandInTest::SetUp();
+    list_directory({"."});
+    ASSERT_TRUE(fs::is_regular_file({"file"}));
+    ASSERT_FALSE(fs::exists({"missing"}));
+  }
+};
+
+TEST_F(ChangeTest, RevalidatesUnchangedDirectoryWithGetattr) {
+  outlive_ttl();
+
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  ASSERT_FALSE(fs::exists({"missing"}));
+  ASSERT_GE(server.calls("getattr"), 1);
+  ASSERT_EQ(server.calls("lookup"), 0);
+  ASSERT_EQ(server.calls("list_page"), 1);
+}
+
+TEST_F(ChangeTest, SeesChangedDirectory) {
+  server.remove("file");
+  server.create("missing", EntryType::FILE);
+  outlive_ttl();
+
+  ASSERT_FALSE(fs::exists({"file"}));
+  ASSERT_TRUE(fs::is_regular_file({"missing"}));
+  // Without a change log the names are looked up, not listed again
+  ASSERT_EQ(server.calls("list_page"), 1);
+}
+
+class DeltaTest : public ChangeTest {
+public:
+  DeltaTest() {
+    server.support("list_changes");
+  }
+};
+
+TEST_F(DeltaTest, SyncsIndexWithDeltas) {
+  server.create("added", EntryType::FILE);
+  server.remove("file");
+  outlive_ttl();
+
+  ASSERT_TRUE(fs::is_regular_file({"added"}));
+  ASSERT_FALSE(fs::exists({"file"}));
+  ASSERT_EQ(server.calls("list_changes"), 1);
+  ASSERT_EQ(server.calls("list_page"), 1);
+  ASSERT_EQ(server.calls("lookup"), 0);
+}
+
+TEST_F(DeltaTest, SyncsLongDeltasInParts) {
+  for (size_t i = 0; i < 40; i++) {
+    server.create("added-" + std::to_string(i), EntryType::FILE);
+  }
+  outlive_ttl();
+
+  for (size_t i = 0; i < 40; i++) {
+    ASSERT_TRUE(fs::is_regular_file({"added-" + std::to_string(i)}));
+  }
+  // Changes come at most 16 at a time
+  ASSERT_EQ(server.calls("list_changes"), 3);
+  ASSERT_EQ(server.calls("lookup"), 0);
+}
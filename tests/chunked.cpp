@@ -0,0 +1,43 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+class ChunkedTest : public StandInTest {
+public:
+  ChunkedTest() {
+    server.create("file", EntryType::FILE);
+    server.create("dir", EntryType::DIRECTORY);
+    server.write("file", std::string(500, 'c'));
+    for (const auto& method: {"lookup", "list", "read"}) {
+      server.chunk(method);
+    }
+  }
+};
+
+TEST_F(ChunkedTest, ParsesChunkedResponses) {
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  ASSERT_TRUE(fs::is_directory({"dir"}));
+  ASSERT_FALSE(fs::exists({"missing"}));
+  ASSERT_EQ(list_directory({"."}), (std::set<std::string>{"dir", "file"}));
+
+  std::ifstream file("file");
+  std::stringstream content;
+  content << file.rdbuf();
+  ASSERT_EQ(content.str(), std::string(500, 'c'));
+}
+
+TEST_F(ChunkedTest, KeepsConnectionAfterChunkedResponses) {
+  for (size_t i = 0; i < 16; i++) {
+    ASSERT_FALSE(fs::exists({"missing-" + std::to_string(i)}));
+  }
+
+  ASSERT_EQ(server.connections(), 1);
+}
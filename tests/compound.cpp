@@ -0,0 +1,72 @@
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+using namespace std::chrono_literals;
+
+namespace fs = std::filesystem;
+
+constexpr size_t COMPOUND_NAMES = 32;
+
+class CompoundTest : public StandInTest {
+public:
+  CompoundTest() {
+    for (size_t i = 0; i < COMPOUND_NAMES; i++) {
+      server.create("file-" + std::to_string(i), EntryType::FILE);
+    }
+  }
+
+protected:
+  /* Looks every name up from its own thread, returns how many of them took
+   * less than the limit */
+  size_t lookup_all(std::chrono::milliseconds limit) {
+    std::atomic<size_t> found = 0;
+    std::atomic<size_t> fast = 0;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < COMPOUND_NAMES; i++) {
+      threads.emplace_back([i, limit, &found, &fast]() {
+        auto start = std::chrono::steady_clock::now();
+        if (fs::is_regular_file({"file-" + std::to_string(i)})) {
+          ++found;
+        }
+        if (std::chrono::steady_clock::now() - start < limit) {
+          ++fast;
+        }
+      });
+    }
+    for (auto& thread: threads) {
+      thread.join();
+    }
+
+    EXPECT_EQ(found, COMPOUND_NAMES);
+    return fast;
+  }
+};
+
+TEST_F(CompoundTest, ConcurrentLookups) {
+  // Lookups queue up while the first one is answered
+  server.delay("lookup", 100ms);
+  lookup_all(0ms);
+
+  ASSERT_GT(server.calls("compound"), 0);
+  ASSERT_LT(server.requests("lookup") + server.requests("compound"), COMPOUND_NAMES);
+  // Grouped or not, every name is looked up exactly once
+  ASSERT_EQ(server.calls("lookup"), COMPOUND_NAMES);
+}
+
+TEST_F(CompoundTest, SendsFullRequestsWithoutWaiting) {
+  // A full request goes out while the first lookup is still being answered
+  server.delay("lookup", 1000ms);
+  size_t fast = lookup_all(500ms);
+
+  ASSERT_GE(fast, 16);
+  ASSERT_GE(server.calls("compound"), 2);
+}
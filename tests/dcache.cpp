@@ -0,0 +1,160 @@
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+/* Entries are trusted for the whole test */
+class DcacheTest : public StandInTest {
+public:
+  DcacheTest() {
+    server.create("file", EntryType::FILE);
+  }
+
+protected:
+  std::string options() const override { return "lookup_ttl=60,negative_ttl=60"; }
+};
+
+/* Entries expire a millisecond after they are looked up */
+class ExpiringDcacheTest : public DcacheTest {
+protected:
+  std::string options() const override { return "lookup_ttl_ms=1,negative_ttl_ms=1"; }
+};
+
+TEST_F(DcacheTest, CachesLookupsWithinTtl) {
+  for (size_t i = 0; i < 16; i++) {
+    ASSERT_TRUE(fs::is_regular_file({"file"}));
+  }
+
+  ASSERT_EQ(server.calls("lookup"), 1);
+}
+
+TEST_F(DcacheTest, KeepsRemovedEntryWithinTtl) {
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  server.remove("file");
+
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  ASSERT_EQ(server.calls("lookup"), 1);
+}
+
+TEST_F(ExpiringDcacheTest, RevalidatesAfterTtl) {
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  outlive_ttl();
+
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  ASSERT_EQ(server.calls("lookup"), 2);
+}
+
+TEST_F(ExpiringDcacheTest, SeesRemovalAfterTtl) {
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  server.remove("file");
+
+  outlive_ttl();
+  ASSERT_FALSE(fs::exists({"file"}));
+}
+
+TEST_F(ExpiringDcacheTest, SeesReplacementAfterTtl) {
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  server.remove("file");
+  server.create("file", EntryType::DIRECTORY);
+
+  outlive_ttl();
+  ASSERT_TRUE(fs::is_directory({"file"}));
+}
+
+TEST_F(DcacheTest, CachesMissesWithinTtl) {
+  for (size_t i = 0; i < 16; i++) {
+    ASSERT_FALSE(fs::exists({"missing"}));
+  }
+
+  ASSERT_EQ(server.calls("lookup"), 1);
+}
+
+TEST_F(DcacheTest, KeepsMissWithinNegativeTtl) {
+  ASSERT_FALSE(fs::exists({"missing"}));
+  server.create("missing", EntryType::FILE);
+
+  ASSERT_FALSE(fs::exists({"missing"}));
+  ASSERT_EQ(server.calls("lookup"), 1);
+}
+
+TEST_F(ExpiringDcacheTest, SeesAddedEntryAfterNegativeTtl) {
+  ASSERT_FALSE(fs::exists({"missing"}));
+  server.create("missing", EntryType::FILE);
+
+  outlive_ttl();
+  ASSERT_TRUE(fs::is_regular_file({"missing"}));
+}
+
+TEST_F(DcacheTest, SeesOwnChangesAtOnce) {
+  ASSERT_FALSE(fs::exists({"new"}));
+  std::ofstream({"new"}) << "content";
+  ASSERT_TRUE(fs::is_regular_file({"new"}));
+
+  ASSERT_TRUE(fs::remove({"file"}));
+  ASSERT_FALSE(fs::exists({"file"}));
+  // Created and removed names are not looked up again
+  ASSERT_EQ(server.calls("lookup"), 2);
+}
+
+/* Entries stay cached for the whole test, so every walk can stay in
+ * RCU-walk */
+class RcuWalkTest : public DcacheTest {
+public:
+  RcuWalkTest() {
+    server.create("dir", EntryType::DIRECTORY);
+  }
+};
+
+TEST_F(RcuWalkTest, ServesCachedPathsConcurrently) {
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  ASSERT_FALSE(fs::exists({"dir/missing"}));
+  size_t lookups = server.calls("lookup");
+
+  std::atomic<size_t> correct = 0;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 8; i++) {
+    threads.emplace_back([&correct]() {
+      for (size_t j = 0; j < 1000; j++) {
+        if (fs::is_regular_file({"file"}) && fs::is_directory({"dir"}) &&
+            !fs::exists({"dir/missing"})) {
+          ++correct;
+        }
+      }
+    });
+  }
+  for (auto& thread: threads) {
+    thread.join();
+  }
+
+  ASSERT_EQ(correct, 8'000);
+  ASSERT_EQ(server.calls("lookup"), lookups);
+}
+
+TEST_F(ExpiringDcacheTest, RevalidatesExpiredNamesConcurrently) {
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  outlive_ttl();
+
+  std::atomic<size_t> found = 0;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 8; i++) {
+    threads.emplace_back([&found]() {
+      if (fs::is_regular_file({"file"})) {
+        ++found;
+      }
+    });
+  }
+  for (auto& thread: threads) {
+    thread.join();
+  }
+
+  ASSERT_EQ(found, 8);
+  ASSERT_GE(server.calls("lookup"), 2);
+}
@@ -0,0 +1,73 @@
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+const std::string ETAG_CONTENT = "tagged content\n";
+
+/* Cached pages of a file are revalidated against its entity tag on open */
+class EtagTest : public StandInTest {
+public:
+  EtagTest() {
+    server.create("file", EntryType::FILE);
+    server.write("file", ETAG_CONTENT);
+  }
+
+protected:
+  static std::string read_file(const fs::path& path) {
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+  }
+};
+
+TEST_F(EtagTest, RevalidatesOnEveryOpen) {
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_EQ(read_file({"file"}), ETAG_CONTENT);
+  }
+
+  ASSERT_EQ(server.calls("read"), 3);
+  ASSERT_EQ(server.not_modified(), 2);
+}
+
+TEST_F(EtagTest, SeesContentOfSameSize) {
+  ASSERT_EQ(read_file({"file"}), ETAG_CONTENT);
+
+  // Size alone can not tell this change apart
+  server.write("file", std::string(ETAG_CONTENT.size(), 'x'));
+
+  ASSERT_EQ(read_file({"file"}), std::string(ETAG_CONTENT.size(), 'x'));
+  ASSERT_EQ(server.not_modified(), 0);
+}
+
+TEST_F(EtagTest, SharesTagBetweenNames) {
+  server.link("file", "alias");
+
+  ASSERT_EQ(read_file({"file"}), ETAG_CONTENT);
+  ASSERT_EQ(read_file({"alias"}), ETAG_CONTENT);
+  ASSERT_EQ(server.not_modified(), 1);
+}
+
+TEST_F(EtagTest, DropsPagesWhenServerCanNotBeAsked) {
+  ASSERT_EQ(read_file({"file"}), ETAG_CONTENT);
+
+  server.fail("read");
+
+  int fd = open("file", O_RDONLY);
+  ASSERT_NE(fd, -1);
+  char buffer[64];
+  ssize_t size = read(fd, buffer, sizeof(buffer));
+  close(fd);
+  ASSERT_EQ(size, -1);
+  ASSERT_EQ(server.not_modified(), 0);
+}
@@ -0,0 +1,57 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+class InodeCacheTest : public StandInTest {
+public:
+  InodeCacheTest() {
+    server.create("file", EntryType::FILE);
+    server.link("file", "alias");
+  }
+};
+
+TEST_F(InodeCacheTest, SharesInodeBetweenNames) {
+  struct stat file_stat, alias_stat;
+  ASSERT_EQ(stat("file", &file_stat), 0);
+  ASSERT_EQ(stat("alias", &alias_stat), 0);
+  ASSERT_EQ(file_stat.st_ino, alias_stat.st_ino);
+
+  std::ofstream({"file"}) << "content";
+  std::ifstream alias("alias");
+  std::stringstream content;
+  content << alias.rdbuf();
+  ASSERT_EQ(content.str(), "content");
+}
+
+TEST_F(InodeCacheTest, CountsLinksMadeThroughMount) {
+  fs::create_hard_link({"file"}, {"another"});
+
+  struct stat file_stat, another_stat;
+  ASSERT_EQ(stat("file", &file_stat), 0);
+  ASSERT_EQ(stat("another", &another_stat), 0);
+  ASSERT_EQ(file_stat.st_ino, another_stat.st_ino);
+  ASSERT_EQ(another_stat.st_nlink, 2);
+}
+
+/* The module knows only the names it has seen, so unlinking one of them must
+ * not leave the inode unlinked while the server still has other names */
+TEST_F(InodeCacheTest, KeepsLastLinkOnUnlink) {
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  ASSERT_TRUE(fs::is_regular_file({"alias"}));
+
+  ASSERT_TRUE(fs::remove({"alias"}));
+
+  struct stat file_stat;
+  ASSERT_EQ(stat("file", &file_stat), 0);
+  ASSERT_GE(file_stat.st_nlink, 1);
+  fs::create_hard_link({"file"}, {"again"});
+  ASSERT_TRUE(fs::is_regular_file({"again"}));
+}
@@ -0,0 +1,63 @@
+#include <filesystem>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+constexpr size_t INDEX_FILES = 100;
+
+class IndexTest : public StandInTest {
+public:
+  IndexTest() {
+    for (size_t i = 0; i < INDEX_FILES; i++) {
+      server.create("file-" + std::to_string(i), EntryType::FILE);
+    }
+    server.support("list_page");
+  }
+
+protected:
+  std::string options() const override { return "lookup_ttl=60"; }
+};
+
+TEST_F(IndexTest, AnswersLookupsFromListing) {
+  ASSERT_EQ(list_directory({"."}).size(), INDEX_FILES);
+
+  for (size_t i = 0; i < INDEX_FILES; i++) {
+    ASSERT_TRUE(fs::is_regular_file({"file-" + std::to_string(i)}));
+    ASSERT_FALSE(fs::exists({"missing-" + std::to_string(i)}));
+  }
+  ASSERT_EQ(server.calls("lookup"), 0);
+}
+
+TEST_F(IndexTest, DropsIndexOnOwnChanges) {
+  ASSERT_EQ(list_directory({"."}).size(), INDEX_FILES);
+  ASSERT_TRUE(fs::remove({"file-0"}));
+
+  ASSERT_TRUE(fs::is_regular_file({"file-1"}));
+  ASSERT_EQ(server.calls("lookup"), 1);
+}
+
+TEST_F(IndexTest, KeepsIndexWithinTtl) {
+  ASSERT_EQ(list_directory({"."}).size(), INDEX_FILES);
+  server.create("late", EntryType::FILE);
+
+  ASSERT_FALSE(fs::exists({"late"}));
+  ASSERT_EQ(server.calls("lookup"), 0);
+}
+
+class ShortIndexTest : public IndexTest {
+protected:
+  std::string options() const override { return "lookup_ttl_ms=1"; }
+};
+
+TEST_F(ShortIndexTest, ExpiresIndexAfterTtl) {
+  ASSERT_EQ(list_directory({"."}).size(), INDEX_FILES);
+  server.create("late", EntryType::FILE);
+
+  outlive_ttl();
+  ASSERT_TRUE(fs::is_regular_file({"late"}));
+}
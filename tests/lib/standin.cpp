@@ -0,0 +1,663 @@
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "standin.hpp"
+
+namespace {
+
+struct attr_info {
+  uint64_t status;
+  unsigned char entry_type;
+  ino_t ino;
+  uint64_t change;
+  uint64_t size;
+};
+
+struct lookup_info {
+  uint64_t status;
+  EntryType entry_type;
+  ino_t ino;
+  uint64_t change;
+  uint64_t size;
+};
+
+struct resolve_info {
+  uint64_t status;
+  size_t components_count;
+  struct component {
+    unsigned char entry_type;
+    ino_t ino;
+    uint64_t change;
+    uint64_t size;
+  } components[16];
+};
+
+struct list_page_response {
+  uint64_t status;
+  uint64_t next_cursor;
+  uint64_t change;
+  size_t entries_count;
+  list_response::entry entries[16];
+};
+
+struct compound_response {
+  uint64_t status;
+  size_t results_count;
+  // Result of a lookup is laid out as its own response
+  lookup_info results[16];
+};
+
+constexpr uint64_t STATUS_ENOENT = 1;
+constexpr uint64_t STATUS_ENOTFILE = 2;
+constexpr uint64_t STATUS_ENOTDIR = 3;
+constexpr uint64_t STATUS_ENOENT_DIR = 4;
+constexpr uint64_t STATUS_EEXIST = 5;
+constexpr uint64_t STATUS_ETRUNCATED = 10;
+
+std::vector<std::string> split(const std::string& value, char separator) {
+  std::vector<std::string> parts;
+  std::stringstream stream(value);
+  for (std::string part; std::getline(stream, part, separator);) {
+    parts.push_back(part);
+  }
+  return parts;
+}
+
+/* Fields of compound operations escape bytes as '~' and two hex digits */
+std::string unescape(const std::string& field) {
+  std::string result;
+  for (size_t i = 0; i < field.size(); i++) {
+    if (field[i] == '~' && i + 2 < field.size()) {
+      result += static_cast<char>(std::stoi(field.substr(i + 1, 2), nullptr, 16));
+      i += 2;
+    } else {
+      result += field[i];
+    }
+  }
+  return result;
+}
+
+template<typename T> std::string encode(const T& value) {
+  return std::string(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+}
+
+StandInServer::StandInServer() {
+  server.set_keep_alive_max_count(1'000);
+  server.set_keep_alive_timeout(1);
+
+  server.Get(
+    R"(/teaching/os/networkfs/v1/[^/]+/fs/\w+)",
+    [this](const httplib::Request& req, httplib::Response& res) { handle(req, res); }
+  );
+  // Binary protocol is not spoken, so its upgrade is refused
+  server.Get(
+    R"(/teaching/os/networkfs/v2/[^/]+/connect)",
+    [this](const httplib::Request&, httplib::Response& res) {
+      std::lock_guard lock(mutex);
+      ++calls_["upgrade"];
+      res.status = 404;
+    }
+  );
+}
+
+void StandInServer::start() {
+  if (!server.bind_to_port("127.0.0.1", STANDIN_PORT)) {
+    throw std::runtime_error("Stand-in server can not listen on port " + std::to_string(STANDIN_PORT));
+  }
+  thread = std::thread([this]() { server.listen_after_bind(); });
+  server.wait_until_ready();
+}
+
+void StandInServer::stop() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+
+  server.stop();
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+void StandInServer::restart() {
+  stop();
+  {
+    std::lock_guard lock(mutex);
+    stopping = false;
+  }
+  start();
+}
+
+StandInServer::~StandInServer() {
+  stop();
+}
+
+/* Every change of the root is pushed, so it is also logged and bumps the
+ * change attribute */
+void StandInServer::push(WatchKind kind, const std::string& name, ino_t ino) {
+  watch_response::event event{};
+  event.kind = kind;
+  event.ino = ROOT_INO;
+  event.entry.entry_type = inodes.at(ino).entry_type;
+  event.entry.ino = ino;
+  strncpy(event.entry.name, name.c_str(), sizeof(event.entry.name) - 1);
+
+  root_log.push_back({kind == WatchKind::REMOVED, event.entry});
+  ++root_change;
+
+  if (losing_events) {
+    lost_events = true;
+  } else {
+    events.push_back(event);
+  }
+  changed.notify_all();
+}
+
+/* Called with the mutex held */
+ino_t StandInServer::add(const std::string& name, EntryType type) {
+  ino_t ino = next_ino++;
+  inodes[ino] = node{type};
+  root[name] = ino;
+  push(WatchKind::ADDED, name, ino);
+  return ino;
+}
+
+ino_t StandInServer::create(const std::string& name, EntryType type) {
+  std::lock_guard lock(mutex);
+  return add(name, type);
+}
+
+void StandInServer::remove(const std::string& name) {
+  std::lock_guard lock(mutex);
+  auto it = root.find(name);
+  if (it == root.end()) {
+    return;
+  }
+  ino_t ino = it->second;
+  root.erase(it);
+  push(WatchKind::REMOVED, name, ino);
+}
+
+void StandInServer::link(const std::string& name, const std::string& new_name) {
+  std::lock_guard lock(mutex);
+  auto it = root.find(name);
+  if (it == root.end()) {
+    return;
+  }
+  root[new_name] = it->second;
+  push(WatchKind::ADDED, new_name, it->second);
+}
+
+void StandInServer::write(const std::string& name, const std::string& content) {
+  std::lock_guard lock(mutex);
+  auto it = root.find(name);
+  if (it == root.end()) {
+    return;
+  }
+  node& file = inodes.at(it->second);
+  file.content = content;
+  ++file.version;
+}
+
+std::string StandInServer::content(const std::string& name) {
+  std::lock_guard lock(mutex);
+  auto it = root.find(name);
+  return it == root.end() ? "" : inodes.at(it->second).content;
+}
+
+size_t StandInServer::not_modified() {
+  std::lock_guard lock(mutex);
+  return not_modified_;
+}
+
+size_t StandInServer::calls(const std::string& method) {
+  std::lock_guard lock(mutex);
+  return calls_[method];
+}
+
+size_t StandInServer::requests(const std::string& method) {
+  std::lock_guard lock(mutex);
+  return requests_[method];
+}
+
+size_t StandInServer::connections() {
+  std::lock_guard lock(mutex);
+  return ports.size();
+}
+
+std::set<std::string> StandInServer::tokens() {
+  std::lock_guard lock(mutex);
+  return tokens_;
+}
+
+void StandInServer::lose_events() {
+  std::lock_guard lock(mutex);
+  losing_events = true;
+}
+
+bool StandInServer::wait_for_watch(std::chrono::milliseconds timeout) {
+  std::unique_lock lock(mutex);
+  return changed.wait_for(lock, timeout, [this]() {
+    return held_watches > 0 && watched == events.size() && !losing_events &&
+           !lost_events;
+  });
+}
+
+void StandInServer::delay(const std::string& method, std::chrono::milliseconds duration) {
+  std::lock_guard lock(mutex);
+  delays[method] = duration;
+}
+
+void StandInServer::fail(const std::string& method) {
+  std::lock_guard lock(mutex);
+  failing.insert(method);
+}
+
+void StandInServer::support(const std::string& method) {
+  std::lock_guard lock(mutex);
+  supported.insert(method);
+}
+
+void StandInServer::chunk(const std::string& method) {
+  std::lock_guard lock(mutex);
+  chunked.insert(method);
+}
+
+void StandInServer::handle(const httplib::Request& req, httplib::Response& res) {
+  std::string method = req.path.substr(req.path.rfind('/') + 1);
+  std::chrono::milliseconds duration{0};
+  bool chunk = false;
+  bool optional = false;
+  {
+    std::lock_guard lock(mutex);
+    ++calls_[method];
+    ++requests_[method];
+    ports.insert(req.remote_port);
+    size_t token_start = API_BASE.size();
+    tokens_.insert(req.path.substr(token_start, req.path.find('/', token_start) - token_start));
+    if (auto it = delays.find(method); it != delays.end()) {
+      duration = it->second;
+    }
+    if (failing.contains(method)) {
+      res.status = 500;
+      return;
+    }
+    chunk = chunked.contains(method);
+    optional = supported.contains(method);
+  }
+  std::this_thread::sleep_for(duration);
+
+  if (method == "lookup") {
+    res.set_content(lookup(req), "application/octet-stream");
+  } else if (method == "create") {
+    res.set_content(create(req), "application/octet-stream");
+  } else if (method == "unlink") {
+    res.set_content(remove(req, EntryType::FILE), "application/octet-stream");
+  } else if (method == "rmdir") {
+    res.set_content(remove(req, EntryType::DIRECTORY), "application/octet-stream");
+  } else if (method == "link") {
+    res.set_content(link(req), "application/octet-stream");
+  } else if (method == "list") {
+    res.set_content(list(req), "application/octet-stream");
+  } else if (method == "list_page" && optional) {
+    res.set_content(list_page(req), "application/octet-stream");
+  } else if (method == "getattr" && optional) {
+    res.set_content(getattr(req), "application/octet-stream");
+  } else if (method == "list_changes" && optional) {
+    res.set_content(list_changes(req), "application/octet-stream");
+  } else if (method == "watch") {
+    res.set_content(watch(req), "application/octet-stream");
+  } else if (method == "snapshot") {
+    res.set_content(snapshot(), "application/octet-stream");
+  } else if (method == "resolve") {
+    res.set_content(resolve(req), "application/octet-stream");
+  } else if (method == "read") {
+    read(req, res);
+  } else if (method == "write") {
+    write(req, res);
+  } else if (method == "compound") {
+    res.set_content(compound(req), "application/octet-stream");
+  } else {
+    // Everything else is optional for the module
+    res.status = 404;
+  }
+
+  if (chunk && !res.body.empty()) {
+    // Chunks are short enough to split every field of the response
+    res.set_chunked_content_provider(
+      "application/octet-stream",
+      [body = std::move(res.body)](size_t offset, httplib::DataSink& sink) {
+        if (offset < body.size()) {
+          sink.write(body.data() + offset, std::min<size_t>(3, body.size() - offset));
+        } else {
+          sink.done();
+        }
+        return true;
+      }
+    );
+  }
+}
+
+std::string StandInServer::lookup(const httplib::Request& req) {
+  return lookup(std::stoull(req.get_param_value("parent")), req.get_param_value("name"));
+}
+
+std::string StandInServer::lookup(ino_t parent, const std::string& name) {
+  std::lock_guard lock(mutex);
+  lookup_info response{};
+
+  auto it = root.find(name);
+  if (parent != ROOT_INO || it == root.end()) {
+    response.status = STATUS_ENOENT_DIR;
+  } else {
+    response.entry_type = inodes.at(it->second).entry_type;
+    response.ino = it->second;
+    response.change = change(it->second);
+    response.size = inodes.at(it->second).content.size();
+  }
+
+  return encode(response);
+}
+
+/* Entries are created and removed only in the root */
+std::string StandInServer::create(const httplib::Request& req) {
+  std::lock_guard lock(mutex);
+  create_response response{};
+
+  std::string name = req.get_param_value("name");
+  if (std::stoull(req.get_param_value("parent")) != ROOT_INO) {
+    response.status = STATUS_ENOENT;
+  } else if (root.contains(name)) {
+    response.status = STATUS_EEXIST;
+  } else {
+    EntryType type = req.get_param_value("type") == "directory" ? EntryType::DIRECTORY
+                                                                  : EntryType::FILE;
+    response.ino = add(name, type);
+  }
+
+  return encode(response);
+}
+
+std::string StandInServer::remove(const httplib::Request& req, EntryType type) {
+  std::lock_guard lock(mutex);
+  uint64_t status = 0;
+
+  auto it = root.find(req.get_param_value("name"));
+  if (std::stoull(req.get_param_value("parent")) != ROOT_INO || it == root.end()) {
+    status = STATUS_ENOENT_DIR;
+  } else if (inodes.at(it->second).entry_type != type) {
+    status = type == EntryType::FILE ? STATUS_ENOTFILE : STATUS_ENOTDIR;
+  } else {
+    ino_t ino = it->second;
+    root.erase(it);
+    push(WatchKind::REMOVED, req.get_param_value("name"), ino);
+  }
+
+  return encode(status);
+}
+
+std::string StandInServer::link(const httplib::Request& req) {
+  std::lock_guard lock(mutex);
+  uint64_t status = 0;
+
+  std::string name = req.get_param_value("name");
+  auto source = inodes.find(std::stoull(req.get_param_value("source")));
+  if (source == inodes.end()) {
+    status = STATUS_ENOENT;
+  } else if (source->second.entry_type != EntryType::FILE) {
+    status = STATUS_ENOTFILE;
+  } else if (std::stoull(req.get_param_value("parent")) != ROOT_INO) {
+    status = STATUS_ENOENT;
+  } else if (root.contains(name)) {
+    status = STATUS_EEXIST;
+  } else {
+    root[name] = source->first;
+    push(WatchKind::ADDED, name, source->first);
+  }
+
+  return encode(status);
+}
+
+std::string StandInServer::list(const httplib::Request& req) {
+  std::lock_guard lock(mutex);
+  list_response response{};
+  if (std::stoull(req.get_param_value("inode")) != ROOT_INO) {
+    // Other directories are always empty
+    return encode(response);
+  }
+
+  for (const auto& [name, ino]: root) {
+    if (response.entries_count == std::size(response.entries)) {
+      break;
+    }
+    auto& item = response.entries[response.entries_count++];
+    item.entry_type = inodes.at(ino).entry_type;
+    item.ino = ino;
+    strncpy(item.name, name.c_str(), sizeof(item.name) - 1);
+  }
+
+  return encode(response);
+}
+
+/* Cursor is the number of entries listed before the page */
+std::string StandInServer::list_page(const httplib::Request& req) {
+  std::lock_guard lock(mutex);
+  list_page_response response{};
+  if (std::stoull(req.get_param_value("inode")) != ROOT_INO) {
+    return encode(response);
+  }
+
+  size_t cursor = std::stoull(req.get_param_value("cursor"));
+  size_t limit = std::min<size_t>(std::stoull(req.get_param_value("limit")),
+                                  std::size(response.entries));
+  auto it = root.begin();
+  std::advance(it, std::min(cursor, root.size()));
+  for (; it != root.end() && response.entries_count < limit; ++it) {
+    auto& item = response.entries[response.entries_count++];
+    item.entry_type = inodes.at(it->second).entry_type;
+    item.ino = it->second;
+    strncpy(item.name, it->first.c_str(), sizeof(item.name) - 1);
+  }
+  if (it != root.end()) {
+    response.next_cursor = cursor + response.entries_count;
+  }
+  response.change = change(ROOT_INO);
+
+  return encode(response);
+}
+
+std::string StandInServer::getattr(const httplib::Request& req) {
+  std::lock_guard lock(mutex);
+  attr_info response{};
+
+  ino_t ino = std::stoull(req.get_param_value("inode"));
+  auto it = inodes.find(ino);
+  if (ino == ROOT_INO) {
+    response.entry_type = static_cast<unsigned char>(EntryType::DIRECTORY);
+  } else if (it != inodes.end()) {
+    response.entry_type = static_cast<unsigned char>(it->second.entry_type);
+    response.size = it->second.content.size();
+  } else {
+    response.status = STATUS_ENOENT;
+    return encode(response);
+  }
+  response.ino = ino;
+  response.change = change(ino);
+
+  return encode(response);
+}
+
+/* Other directories never change, so their log is empty */
+std::string StandInServer::list_changes(const httplib::Request& req) {
+  std::lock_guard lock(mutex);
+  entries_delta response{};
+
+  uint64_t since = std::stoull(req.get_param_value("since"));
+  if (std::stoull(req.get_param_value("inode")) != ROOT_INO) {
+    response.change = since;
+    return encode(response);
+  }
+  if (since == 0 || since > root_change) {
+    response.status = STATUS_ETRUNCATED;
+    return encode(response);
+  }
+
+  size_t position = since - 1;
+  while (position < root_log.size() && response.changes_count < std::size(response.changes)) {
+    response.changes[response.changes_count++] = root_log[position++];
+  }
+  response.change = position + 1;
+  if (position < root_log.size()) {
+    response.next_since = response.change;
+  }
+
+  return encode(response);
+}
+
+/* Changes are tracked only by servers with getattr. Other directories never
+ * change, a file changes with its content. Called with the mutex held. */
+uint64_t StandInServer::change(ino_t ino) {
+  if (!supported.contains("getattr")) {
+    return 0;
+  } else if (ino == ROOT_INO) {
+    return root_change;
+  }
+  const node& entry = inodes.at(ino);
+  return entry.entry_type == EntryType::FILE ? entry.version + 1 : 1;
+}
+
+/* since is one more than the number of events the module has seen, so that
+ * zero can ask for the current position */
+std::string StandInServer::watch(const httplib::Request& req) {
+  std::unique_lock lock(mutex);
+  watch_response response{};
+
+  uint64_t since = std::stoull(req.get_param_value("since"));
+  if (since == 0) {
+    response.next_since = events.size() + 1;
+    return encode(response);
+  }
+
+  size_t seen = std::min<size_t>(since - 1, events.size());
+  auto timeout = std::chrono::seconds(std::stoi(req.get_param_value("timeout")));
+  ++held_watches;
+  watched = seen;
+  changed.notify_all();
+  changed.wait_for(lock, timeout, [&]() {
+    return stopping || lost_events || events.size() > seen;
+  });
+  --held_watches;
+
+  if (lost_events) {
+    losing_events = lost_events = false;
+    response.status = STATUS_ETRUNCATED;
+    return encode(response);
+  }
+
+  while (seen < events.size() && response.events_count < std::size(response.events)) {
+    response.events[response.events_count++] = events[seen++];
+  }
+  response.next_since = seen + 1;
+
+  return encode(response);
+}
+
+std::string StandInServer::snapshot() {
+  std::lock_guard lock(mutex);
+  uint64_t status = 0;
+  uint64_t records_count = root.size();
+  std::string response = encode(status) + encode(records_count);
+
+  for (const auto& [name, ino]: root) {
+    tree_record record{
+      ROOT_INO, ino,
+      static_cast<unsigned char>(inodes.at(ino).entry_type),
+      static_cast<unsigned char>(name.size())
+    };
+    response += encode(record) + name;
+    // Every record starts at a multiple of 8 bytes
+    response.resize((response.size() + 7) / 8 * 8, '\0');
+  }
+
+  return response;
+}
+
+/* Directories below the root are empty, so at most one component resolves */
+std::string StandInServer::resolve(const httplib::Request& req) {
+  std::lock_guard lock(mutex);
+  resolve_info response{};
+
+  std::string path = req.get_param_value("path");
+  auto it = root.find(path.substr(0, path.find('/')));
+  if (std::stoull(req.get_param_value("parent")) == ROOT_INO && it != root.end()) {
+    response.components[0].entry_type = static_cast<unsigned char>(inodes.at(it->second).entry_type);
+    response.components[0].ino = it->second;
+    response.components[0].size = inodes.at(it->second).content.size();
+    response.components_count = 1;
+  }
+
+  return encode(response);
+}
+
+/* Only lookups may be compounded, the stand-in has no other operations */
+std::string StandInServer::compound(const httplib::Request& req) {
+  compound_response response{};
+
+  for (const auto& op: split(req.get_param_value("ops"), ';')) {
+    std::vector<std::string> fields = split(op, ',');
+    std::map<std::string, std::string> args;
+    for (size_t i = 1; i + 1 < fields.size(); i += 2) {
+      args[unescape(fields[i])] = unescape(fields[i + 1]);
+    }
+
+    std::string result = lookup(std::stoull(args["parent"]), args["name"]);
+    memcpy(&response.results[response.results_count++], result.data(), result.size());
+    {
+      std::lock_guard lock(mutex);
+      ++calls_[unescape(fields[0])];
+    }
+  }
+
+  return encode(response);
+}
+
+void StandInServer::read(const httplib::Request& req, httplib::Response& res) {
+  std::lock_guard lock(mutex);
+  auto it = inodes.find(std::stoull(req.get_param_value("inode")));
+  if (it == inodes.end() || it->second.entry_type != EntryType::FILE) {
+    res.set_content(encode(STATUS_ENOENT), "application/octet-stream");
+    return;
+  }
+
+  std::string etag = "\"" + std::to_string(it->second.version) + "\"";
+  res.set_header("ETag", etag);
+  if (req.get_header_value("If-None-Match") == etag) {
+    ++not_modified_;
+    res.status = 304;
+    return;
+  }
+
+  uint64_t status = 0;
+  uint64_t content_length = it->second.content.size();
+  res.set_content(encode(status) + encode(content_length) + it->second.content,
+                  "application/octet-stream");
+}
+
+void StandInServer::write(const httplib::Request& req, httplib::Response& res) {
+  std::lock_guard lock(mutex);
+  uint64_t status = 0;
+  auto it = inodes.find(std::stoull(req.get_param_value("inode")));
+  if (it == inodes.end() || it->second.entry_type != EntryType::FILE) {
+    status = STATUS_ENOENT;
+  } else {
+    it->second.content = req.get_param_value("content");
+    ++it->second.version;
+    res.set_header("ETag", "\"" + std::to_string(it->second.version) + "\"");
+  }
+  res.set_content(encode(status), "application/octet-stream");
+}
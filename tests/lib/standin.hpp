@@ -0,0 +1,170 @@
+#ifndef NETWORKFS_TEST_STANDIN_HPP
+#define NETWORKFS_TEST_STANDIN_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <httplib.h>
+
+#include "nfs.hpp"
+#include "util.hpp"
+
+constexpr int STANDIN_PORT = 18080;
+constexpr const char* STANDIN_TOKEN = "00000000-0000-0000-0000-000000000000";
+
+enum class WatchKind : unsigned char {
+  CHANGED = 0,
+  ADDED = 1,
+  REMOVED = 2
+};
+
+struct watch_response {
+  uint64_t status;
+  uint64_t next_since;
+  size_t events_count;
+  struct event {
+    WatchKind kind;
+    ino_t ino;
+    list_response::entry entry;
+  } events[16];
+};
+
+struct entries_delta {
+  uint64_t status;
+  uint64_t change;
+  uint64_t next_since;
+  size_t changes_count;
+  struct entry_change {
+    unsigned char removed;
+    list_response::entry entry;
+  } changes[16];
+};
+
+struct tree_record {
+  ino_t parent;
+  ino_t ino;
+  unsigned char entry_type;
+  unsigned char name_length;
+};
+
+/* Local server implementing just enough of the API for a flat root directory.
+ * Changes made through it are pushed to the module with long-poll watch.
+ * Files may have several names, which share their content. */
+class StandInServer {
+private:
+  struct node {
+    EntryType entry_type;
+    std::string content;
+    uint64_t version = 0;  // serves as entity tag of the content
+  };
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::map<ino_t, node> inodes;
+  std::map<std::string, ino_t> root;
+  uint64_t root_change = 1;  // change attribute of the root
+  std::vector<entries_delta::entry_change> root_log;  // i-th one made it i + 2
+  std::vector<watch_response::event> events;
+  ino_t next_ino = ROOT_INO + 1;
+  size_t held_watches = 0;
+  size_t watched = 0;  // events seen by the module when it held a watch call
+  bool losing_events = false;
+  bool lost_events = false;
+  bool stopping = false;
+  std::map<std::string, size_t> calls_;
+  std::map<std::string, size_t> requests_;
+  std::set<int> ports;  // client ports of connections requests came over
+  std::set<std::string> tokens_;
+  size_t not_modified_ = 0;
+  std::map<std::string, std::chrono::milliseconds> delays;
+  std::set<std::string> failing;
+  std::set<std::string> chunked;
+  std::set<std::string> supported;
+
+  httplib::Server server;
+  std::thread thread;
+
+  void push(WatchKind, const std::string&, ino_t);
+  ino_t add(const std::string&, EntryType);
+  void handle(const httplib::Request&, httplib::Response&);
+  std::string lookup(const httplib::Request&);
+  std::string lookup(ino_t, const std::string&);
+  std::string create(const httplib::Request&);
+  std::string remove(const httplib::Request&, EntryType);
+  std::string link(const httplib::Request&);
+  std::string list(const httplib::Request&);
+  std::string list_page(const httplib::Request&);
+  std::string getattr(const httplib::Request&);
+  std::string list_changes(const httplib::Request&);
+  uint64_t change(ino_t);
+  std::string watch(const httplib::Request&);
+  std::string snapshot();
+  void read(const httplib::Request&, httplib::Response&);
+  void write(const httplib::Request&, httplib::Response&);
+  std::string resolve(const httplib::Request&);
+  std::string compound(const httplib::Request&);
+public:
+  StandInServer();
+
+  StandInServer(const StandInServer&) = delete;
+  StandInServer& operator=(const StandInServer&) = delete;
+
+  void start();
+  void stop();
+  /* Stops and starts again, which closes every connection of the module */
+  void restart();
+
+  ino_t create(const std::string&, EntryType);
+  void remove(const std::string&);
+  /* Gives the file one more name */
+  void link(const std::string&, const std::string&);
+  void write(const std::string&, const std::string&);
+  std::string content(const std::string&);
+
+  /* Answers every later call of the API method only after the delay */
+  void delay(const std::string&, std::chrono::milliseconds);
+
+  /* Answers the optional API method, which is refused with 404 otherwise */
+  void support(const std::string&);
+
+  /* Answers every later call of the API method with 500 */
+  void fail(const std::string&);
+
+  /* Sends bodies of later responses to the API method with chunked transfer
+   * encoding, a few bytes per chunk */
+  void chunk(const std::string&);
+
+  /* Drops later changes from the event log, so the next watch call learns
+   * that events were lost */
+  void lose_events();
+
+  /* Waits until the module holds a watch call open, having applied every
+   * event made so far */
+  bool wait_for_watch(std::chrono::milliseconds);
+
+  /* Number of reads answered with 304 Not Modified */
+  size_t not_modified();
+
+  /* Number of calls of the API method made by the module, including
+   * operations carried by compound. Upgrades to the binary protocol are
+   * counted as "upgrade" */
+  size_t calls(const std::string&);
+
+  /* Number of HTTP requests for the API method made by the module */
+  size_t requests(const std::string&);
+
+  /* Number of connections the module made requests over */
+  size_t connections();
+
+  /* Tokens that paths of API calls carried */
+  std::set<std::string> tokens();
+
+  ~StandInServer();
+};
+
+#endif
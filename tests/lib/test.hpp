@@ -1,11 +1,15 @@
 #ifndef NETWORKFS_TEST_TEST_HPP
 #define NETWORKFS_TEST_TEST_HPP
 
+#include <cstring>
 #include <filesystem>
+#include <string>
+#include <sys/mount.h>
 
 #include <gtest/gtest.h>
 
 #include "nfs.hpp"
+#include "standin.hpp"
 #include "util.hpp"
 
 namespace fs = std::filesystem;
@@ -31,4 +35,37 @@ protected:
   }
 };
 
+/* Mounts a local stand-in server with extra mount options */
+class StandInTest : public testing::Test {
+public:
+  fs::path previous_path;
+  StandInServer server;
+
+protected:
+  virtual std::string options() const { return ""; }
+
+  void SetUp() override {
+    server.start();
+
+    std::string all_options = "server=127.0.0.1,port=" + std::to_string(STANDIN_PORT);
+    if (!options().empty()) {
+      all_options += "," + options();
+    }
+    if (mount(STANDIN_TOKEN, TEST_ROOT.c_str(), "networkfs", 0, all_options.c_str())) {
+      throw std::runtime_error(std::string("Filesystem can not be mounted: ") + strerror(errno));
+    }
+
+    previous_path = fs::current_path();
+    fs::current_path(TEST_ROOT);
+  }
+
+  void TearDown() override {
+    fs::current_path(previous_path);
+    if (umount(TEST_ROOT.c_str())) {
+      std::cerr << "error: Filesystem can not be unmounted: " << strerror(errno) << std::endl;
+    }
+    server.stop();
+  }
+};
+
 #endif
@@ -1,6 +1,8 @@
 #include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <set>
+#include <thread>
 
 namespace fs = std::filesystem;
 
@@ -15,3 +17,7 @@ std::set<std::string> list_directory(const fs::path& path) {
 
   return result;
 }
+
+void outlive_ttl() {
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+}
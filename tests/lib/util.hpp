@@ -13,4 +13,8 @@ const fs::path TEST_ROOT = fs::path("/mnt/networkfs-test");
 
 std::set<std::string> list_directory(const fs::path& path);
 
+/* Waits until entries cached with a TTL of 1ms have expired. Jiffies may
+ * advance only every 10ms */
+void outlive_ttl();
+
 #endif
@@ -1,3 +1,4 @@
+#include <cerrno>
 #include <filesystem>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -51,6 +52,15 @@ TEST_F(LinkTest, Unlink) {
     ASSERT_EQ(file3_status, 4);
 }
 
+TEST_F(LinkTest, ExistingName) {
+    ASSERT_FALSE(fs::exists({"file3"}));
+    // Name appears behind the back of the mount, which still has it as missing
+    nfs.create(ROOT_INO, "file3", EntryType::FILE);
+
+    ASSERT_EQ(link("file1", "file3"), -1);
+    ASSERT_EQ(errno, EEXIST);
+}
+
 TEST_F(LinkTest, OtherDirectory) {
     nfs.clear();
 
@@ -0,0 +1,100 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+/* Mounts the in-kernel loopback backend, no server is involved */
+class LoopbackTest : public testing::Test {
+public:
+  fs::path previous_path;
+
+protected:
+  void SetUp() override {
+    if (mount(STANDIN_TOKEN, TEST_ROOT.c_str(), "networkfs", 0, "transport=loopback")) {
+      throw std::runtime_error(std::string("Filesystem can not be mounted: ") + strerror(errno));
+    }
+
+    previous_path = fs::current_path();
+    fs::current_path(TEST_ROOT);
+  }
+
+  void TearDown() override {
+    fs::current_path(previous_path);
+    if (umount(TEST_ROOT.c_str())) {
+      std::cerr << "error: Filesystem can not be unmounted: " << strerror(errno) << std::endl;
+    }
+  }
+
+  std::string read(const fs::path& path) {
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+  }
+};
+
+TEST_F(LoopbackTest, StartsEmpty) {
+  ASSERT_EQ(list_directory({"."}), std::set<std::string>{});
+}
+
+TEST_F(LoopbackTest, KeepsTree) {
+  ASSERT_TRUE(fs::create_directory({"dir"}));
+  ASSERT_TRUE(fs::create_directory({"dir/subdir"}));
+  std::ofstream({"dir/subdir/file"}) << "content";
+
+  ASSERT_EQ(list_directory({"."}), std::set<std::string>{"dir"});
+  ASSERT_EQ(list_directory({"dir"}), std::set<std::string>{"subdir"});
+  ASSERT_TRUE(fs::is_regular_file({"dir/subdir/file"}));
+  ASSERT_EQ(read({"dir/subdir/file"}), "content");
+}
+
+TEST_F(LoopbackTest, LinksAndRemoves) {
+  std::ofstream({"file"}) << "content";
+  fs::create_hard_link({"file"}, {"link"});
+
+  struct stat file_stat, link_stat;
+  ASSERT_EQ(stat("file", &file_stat), 0);
+  ASSERT_EQ(stat("link", &link_stat), 0);
+  ASSERT_EQ(file_stat.st_ino, link_stat.st_ino);
+
+  ASSERT_TRUE(fs::remove({"file"}));
+  ASSERT_FALSE(fs::exists({"file"}));
+  ASSERT_EQ(read({"link"}), "content");
+
+  ASSERT_TRUE(fs::create_directory({"dir"}));
+  ASSERT_TRUE(fs::remove({"dir"}));
+  ASSERT_EQ(list_directory({"."}), std::set<std::string>{"link"});
+}
+
+TEST_F(LoopbackTest, ForgetsTreeOnUnmount) {
+  std::ofstream({"file"}) << "content";
+
+  fs::current_path(previous_path);
+  ASSERT_EQ(umount(TEST_ROOT.c_str()), 0);
+  ASSERT_EQ(mount(STANDIN_TOKEN, TEST_ROOT.c_str(), "networkfs", 0, "transport=loopback"), 0);
+  fs::current_path(TEST_ROOT);
+
+  ASSERT_FALSE(fs::exists({"file"}));
+}
+
+TEST_F(LoopbackTest, GrowsDirectories) {
+  std::set<std::string> names;
+  for (size_t i = 0; i < 100; i++) {
+    names.insert("file" + std::to_string(i));
+    std::ofstream({"file" + std::to_string(i)}) << "content";
+  }
+
+  ASSERT_EQ(list_directory({"."}), names);
+  ASSERT_EQ(read({"file99"}), "content");
+}
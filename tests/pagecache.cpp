@@ -0,0 +1,78 @@
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+const std::string PAGECACHE_CONTENT = "hello from the page cache\n";
+
+class PageCacheTest : public StandInTest {
+public:
+  PageCacheTest() {
+    server.create("file", EntryType::FILE);
+    server.write("file", PAGECACHE_CONTENT);
+  }
+
+protected:
+  static std::string read_file(const fs::path& path) {
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+  }
+};
+
+TEST_F(PageCacheTest, ReportsSize) {
+  // Lookup alone reports the size, the file is not opened before stat
+  ASSERT_EQ(fs::file_size({"file"}), PAGECACHE_CONTENT.size());
+  ASSERT_EQ(server.calls("read"), 0);
+}
+
+TEST_F(PageCacheTest, SkipsReadWhenTruncating) {
+  std::ofstream file("file", std::ios::trunc);
+  file << "new";
+  file.close();
+
+  ASSERT_EQ(server.calls("read"), 0);
+  ASSERT_EQ(read_file({"file"}), "new");
+}
+
+TEST_F(PageCacheTest, ServesRepeatedReadsFromCache) {
+  ASSERT_EQ(read_file({"file"}), PAGECACHE_CONTENT);
+  ASSERT_EQ(read_file({"file"}), PAGECACHE_CONTENT);
+
+  // Second open only checks the entity tag
+  ASSERT_EQ(server.calls("read"), 2);
+  ASSERT_EQ(server.not_modified(), 1);
+}
+
+TEST_F(PageCacheTest, SeesNewContent) {
+  ASSERT_EQ(read_file({"file"}), PAGECACHE_CONTENT);
+
+  server.write("file", "changed");
+
+  ASSERT_EQ(read_file({"file"}), "changed");
+  ASSERT_EQ(server.not_modified(), 0);
+}
+
+TEST_F(PageCacheTest, MapsContent) {
+  int fd = open("file", O_RDONLY);
+  ASSERT_NE(fd, -1);
+
+  void* addr = mmap(nullptr, PAGECACHE_CONTENT.size(), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  ASSERT_NE(addr, MAP_FAILED);
+
+  std::string mapped(static_cast<const char*>(addr), PAGECACHE_CONTENT.size());
+  munmap(addr, PAGECACHE_CONTENT.size());
+  ASSERT_EQ(mapped, PAGECACHE_CONTENT);
+}
@@ -0,0 +1,73 @@
+#include <dirent.h>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+constexpr size_t PAGINATION_FILES = 100;
+
+class PaginationTest : public StandInTest {
+public:
+  std::set<std::string> expected;
+
+  PaginationTest() {
+    for (size_t i = 0; i < PAGINATION_FILES; i++) {
+      std::string name = "file-" + std::to_string(i);
+      server.create(name, EntryType::FILE);
+      expected.insert(name);
+    }
+    server.support("list_page");
+  }
+};
+
+TEST_F(PaginationTest, ListsPageByPage) {
+  ASSERT_EQ(list_directory({"."}), expected);
+
+  // Pages hold 16 entries
+  ASSERT_EQ(server.calls("list_page"), 7);
+  ASSERT_EQ(server.calls("list"), 0);
+}
+
+TEST_F(PaginationTest, SeeksBackToEarlierPage) {
+  DIR* dir = opendir(".");
+  ASSERT_NE(dir, nullptr);
+  std::vector<std::pair<long, std::string>> positions;
+  while (true) {
+    long position = telldir(dir);
+    struct dirent* entry = readdir(dir);
+    if (entry == nullptr) {
+      break;
+    }
+    positions.emplace_back(position, entry->d_name);
+  }
+  ASSERT_EQ(positions.size(), PAGINATION_FILES + 2);
+
+  // Cursors only go forward, so the listing starts over
+  seekdir(dir, positions[5].first);
+  struct dirent* entry = readdir(dir);
+  ASSERT_NE(entry, nullptr);
+  ASSERT_EQ(entry->d_name, positions[5].second);
+  ASSERT_EQ(closedir(dir), 0);
+}
+
+class UnpaginatedTest : public StandInTest {
+public:
+  UnpaginatedTest() {
+    server.create("file", EntryType::FILE);
+    server.create("dir", EntryType::DIRECTORY);
+  }
+};
+
+TEST_F(UnpaginatedTest, FallsBackToList) {
+  std::set<std::string> expected{"dir", "file"};
+  ASSERT_EQ(list_directory({"."}), expected);
+  ASSERT_EQ(list_directory({"."}), expected);
+
+  // Refused list_page is not tried again
+  ASSERT_EQ(server.calls("list_page"), 1);
+  ASSERT_EQ(server.calls("list"), 2);
+}
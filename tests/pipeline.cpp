@@ -0,0 +1,76 @@
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+using namespace std::chrono_literals;
+
+namespace fs = std::filesystem;
+
+constexpr size_t PIPELINE_FILES = 32;
+
+class PipelineTest : public StandInTest {
+public:
+  PipelineTest() {
+    for (size_t i = 0; i < PIPELINE_FILES; i++) {
+      server.create("file-" + std::to_string(i), EntryType::FILE);
+    }
+  }
+};
+
+TEST_F(PipelineTest, MatchesResponsesToConcurrentCalls) {
+  // Calls overlap, so they are queued behind each other on few connections
+  server.delay("lookup", 20ms);
+
+  std::atomic<size_t> matched = 0;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < PIPELINE_FILES; i++) {
+    threads.emplace_back([i, &matched]() {
+      if (fs::is_regular_file({"file-" + std::to_string(i)})) {
+        ++matched;
+      }
+    });
+  }
+  for (auto& thread: threads) {
+    thread.join();
+  }
+
+  ASSERT_EQ(matched, PIPELINE_FILES);
+  // Pool of the module opens at most four connections
+  ASSERT_LE(server.connections(), 4);
+}
+
+TEST_F(PipelineTest, AnswersConcurrentCallsInAboutOneRoundTrip) {
+  constexpr size_t STATS = 16;
+  constexpr auto DELAY = 100ms;
+  // Stand-in answers requests of one connection in order, so only calls sent
+  // together rather than queued one after another finish at once
+  server.delay("lookup", DELAY);
+  server.delay("compound", DELAY);
+
+  std::atomic<size_t> matched = 0;
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < STATS; i++) {
+    threads.emplace_back([i, &matched]() {
+      if (fs::is_regular_file({"file-" + std::to_string(i)})) {
+        ++matched;
+      }
+    });
+  }
+  for (auto& thread: threads) {
+    thread.join();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  ASSERT_EQ(matched, STATS);
+  // First call goes alone, the rest share the next round trip
+  ASSERT_LT(elapsed, 3 * DELAY);
+}
@@ -0,0 +1,42 @@
+#include <filesystem>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+class PoolTest : public StandInTest {};
+
+TEST_F(PoolTest, ReusesConnection) {
+  for (size_t i = 0; i < 64; i++) {
+    ASSERT_FALSE(fs::exists({"missing-" + std::to_string(i)}));
+  }
+
+  ASSERT_EQ(server.calls("lookup"), 64);
+  ASSERT_EQ(server.connections(), 1);
+}
+
+TEST_F(PoolTest, ReconnectsAfterServerCloses) {
+  server.create("file", EntryType::FILE);
+  ASSERT_FALSE(fs::exists({"missing"}));
+
+  server.restart();
+
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  ASSERT_EQ(server.connections(), 2);
+}
+
+/* Changes are never sent over a connection the server has closed, where
+ * they could not be retried */
+TEST_F(PoolTest, ChangesAfterServerCloses) {
+  ASSERT_FALSE(fs::exists({"missing"}));
+
+  server.restart();
+
+  ASSERT_TRUE(fs::create_directory({"dir"}));
+  ASSERT_TRUE(fs::is_directory({"dir"}));
+  ASSERT_EQ(server.calls("create"), 1);
+}
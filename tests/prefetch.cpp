@@ -0,0 +1,69 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+using namespace std::chrono_literals;
+
+namespace fs = std::filesystem;
+
+class PrefetchTest : public StandInTest {
+public:
+  PrefetchTest() {
+    server.create("file1", EntryType::FILE);
+    server.create("dir", EntryType::DIRECTORY);
+  }
+
+protected:
+  std::string options() const override {
+    return "prefetch_depth=2,lookup_ttl=60";
+  }
+
+  /* Number of directories the prefetcher has yet to crawl, from mountstats */
+  static size_t queued() {
+    std::ifstream stats("/proc/self/mountstats");
+    std::string mount = "mounted on " + TEST_ROOT.string() + " with fstype networkfs";
+    for (std::string line; std::getline(stats, line);) {
+      if (line.find(mount) == std::string::npos) {
+        continue;
+      }
+      while (std::getline(stats, line) && line.find("device ") != 0) {
+        size_t position = line.find("prefetch: queued ");
+        if (position != std::string::npos) {
+          return std::stoull(line.substr(position + std::string("prefetch: queued ").size()));
+        }
+      }
+      break;
+    }
+    throw std::runtime_error("No prefetch statistics in mountstats");
+  }
+
+  /* Waits until the crawl started at mount has finished */
+  static bool wait_for_crawl(std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (queued() != 0) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        return false;
+      }
+      std::this_thread::sleep_for(10ms);
+    }
+    return true;
+  }
+};
+
+TEST_F(PrefetchTest, CrawlsAtMount) {
+  ASSERT_TRUE(wait_for_crawl(5s));
+
+  // Root and its only subdirectory
+  ASSERT_EQ(server.calls("list"), 2);
+
+  ASSERT_TRUE(fs::is_regular_file({"file1"}));
+  ASSERT_TRUE(fs::is_directory({"dir"}));
+  ASSERT_EQ(server.calls("lookup"), 0);
+}
@@ -0,0 +1,25 @@
+#include <filesystem>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+class ProtocolTest : public StandInTest {
+public:
+  ProtocolTest() {
+    server.create("file", EntryType::FILE);
+  }
+};
+
+TEST_F(ProtocolTest, FallsBackToHttpApi) {
+  ASSERT_EQ(server.calls("upgrade"), 1);
+
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  ASSERT_EQ(list_directory({"."}), std::set<std::string>{"file"});
+  ASSERT_EQ(server.calls("lookup"), 1);
+  // Binary protocol is not retried for later calls
+  ASSERT_EQ(server.calls("upgrade"), 1);
+}
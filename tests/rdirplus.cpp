@@ -0,0 +1,58 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+constexpr size_t RDIRPLUS_FILES = 10;
+
+class RdirplusTest : public StandInTest {
+public:
+  RdirplusTest() {
+    for (size_t i = 0; i < RDIRPLUS_FILES; i++) {
+      server.create("file-" + std::to_string(i), EntryType::FILE);
+    }
+  }
+
+protected:
+  std::string options() const override { return "rdirplus,lookup_ttl=60"; }
+
+  /* Lists like ls -l, which makes the next listing prime dentries. Creating
+   * a file drops the index of the listing, so only dentries remain. */
+  void list_and_stat() {
+    list_directory({"."});
+    ASSERT_TRUE(fs::is_regular_file({"file-0"}));
+    list_directory({"."});
+    std::ofstream({"new"});
+  }
+};
+
+TEST_F(RdirplusTest, PrimesDentriesFromListing) {
+  list_and_stat();
+  size_t lookups = server.calls("lookup");
+
+  for (size_t i = 1; i < RDIRPLUS_FILES; i++) {
+    ASSERT_TRUE(fs::is_regular_file({"file-" + std::to_string(i)}));
+  }
+  ASSERT_EQ(server.calls("lookup"), lookups);
+}
+
+class NoRdirplusTest : public RdirplusTest {
+protected:
+  std::string options() const override { return "lookup_ttl=60"; }
+};
+
+TEST_F(NoRdirplusTest, LooksUpListedEntries) {
+  list_and_stat();
+  size_t lookups = server.calls("lookup");
+
+  for (size_t i = 1; i < RDIRPLUS_FILES; i++) {
+    ASSERT_TRUE(fs::is_regular_file({"file-" + std::to_string(i)}));
+  }
+  ASSERT_EQ(server.calls("lookup"), lookups + RDIRPLUS_FILES - 1);
+}
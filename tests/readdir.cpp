@@ -0,0 +1,89 @@
+#include <atomic>
+#include <dirent.h>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+class ReaddirTest : public StandInTest {
+public:
+  std::set<std::string> expected{"dir", "file1", "file2"};
+
+  ReaddirTest() {
+    server.create("file1", EntryType::FILE);
+    server.create("file2", EntryType::FILE);
+    server.create("dir", EntryType::DIRECTORY);
+  }
+
+protected:
+  /* Reads the rest of the stream, dots excluded */
+  static std::set<std::string> read_names(DIR* dir) {
+    std::set<std::string> names;
+    while (struct dirent* entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name != "." && name != "..") {
+        names.insert(name);
+      }
+    }
+    return names;
+  }
+};
+
+TEST_F(ReaddirTest, RewindSeesCurrentEntries) {
+  DIR* dir = opendir(".");
+  ASSERT_NE(dir, nullptr);
+  ASSERT_EQ(read_names(dir), expected);
+
+  server.create("new", EntryType::FILE);
+  rewinddir(dir);
+  expected.insert("new");
+  ASSERT_EQ(read_names(dir), expected);
+  ASSERT_EQ(closedir(dir), 0);
+}
+
+TEST_F(ReaddirTest, SeeksToTold) {
+  DIR* dir = opendir(".");
+  ASSERT_NE(dir, nullptr);
+  std::vector<std::pair<long, std::string>> positions;
+  while (true) {
+    long position = telldir(dir);
+    struct dirent* entry = readdir(dir);
+    if (entry == nullptr) {
+      break;
+    }
+    positions.emplace_back(position, entry->d_name);
+  }
+  ASSERT_EQ(positions.size(), expected.size() + 2);
+
+  for (auto it = positions.rbegin(); it != positions.rend(); ++it) {
+    seekdir(dir, it->first);
+    struct dirent* entry = readdir(dir);
+    ASSERT_NE(entry, nullptr);
+    ASSERT_EQ(entry->d_name, it->second);
+  }
+  ASSERT_EQ(closedir(dir), 0);
+}
+
+TEST_F(ReaddirTest, ListsConcurrently) {
+  std::atomic<size_t> matched = 0;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 8; i++) {
+    threads.emplace_back([this, &matched]() {
+      for (size_t j = 0; j < 16; j++) {
+        if (list_directory({"."}) == expected) {
+          ++matched;
+        }
+      }
+    });
+  }
+  for (auto& thread: threads) {
+    thread.join();
+  }
+
+  ASSERT_EQ(matched, 8 * 16);
+}
@@ -0,0 +1,42 @@
+#include <filesystem>
+#include <set>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+constexpr size_t LONG_NAMES = 16;
+
+class RequestTest : public StandInTest {
+public:
+  std::set<std::string> names;
+
+  /* As many entries with the longest names as a listing holds, so
+   * responses fill the buffers */
+  RequestTest() {
+    for (size_t i = 0; i < LONG_NAMES; i++) {
+      std::string name = std::to_string(i);
+      name.resize(255, 'x');
+      server.create(name, EntryType::FILE);
+      names.insert(name);
+    }
+  }
+};
+
+TEST_F(RequestTest, CarriesTokenOfMount) {
+  ASSERT_FALSE(fs::exists({"missing"}));
+  ASSERT_EQ(list_directory({"."}), names);
+
+  ASSERT_EQ(server.tokens(), std::set<std::string>{STANDIN_TOKEN});
+}
+
+TEST_F(RequestTest, FitsLongestNames) {
+  ASSERT_EQ(list_directory({"."}), names);
+  for (const auto& name: names) {
+    ASSERT_TRUE(fs::is_regular_file({name}));
+  }
+}
@@ -0,0 +1,57 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "../ioctl.h"
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+class ResolveTest : public StandInTest {
+public:
+  ResolveTest() {
+    server.create("dir", EntryType::DIRECTORY);
+  }
+
+protected:
+  // Dentries primed by resolve stay valid, so no lookup follows it
+  std::string options() const override { return "lookup_ttl=60"; }
+
+  unsigned int resolve(const std::string& path) {
+    int fd = open(".", O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+      throw std::runtime_error(std::string("Can not open root: ") + strerror(errno));
+    }
+
+    networkfs_resolve_args args{};
+    args.path = reinterpret_cast<__u64>(path.data());
+    args.path_length = path.size();
+    int ret = ioctl(fd, NETWORKFS_IOC_RESOLVE, &args);
+    close(fd);
+
+    if (ret == -1) {
+      throw std::runtime_error(std::string("Can not resolve: ") + strerror(errno));
+    }
+    return args.resolved;
+  }
+};
+
+TEST_F(ResolveTest, ResolvesInOneCall) {
+  ASSERT_EQ(resolve("dir/missing/file"), 1);
+  ASSERT_EQ(server.calls("resolve"), 1);
+
+  ASSERT_TRUE(fs::is_directory({"dir"}));
+  ASSERT_EQ(server.calls("lookup"), 0);
+}
+
+TEST_F(ResolveTest, RejectsDotComponents) {
+  ASSERT_THROW(resolve("dir/../dir"), std::runtime_error);
+}
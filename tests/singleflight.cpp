@@ -0,0 +1,63 @@
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+using namespace std::chrono_literals;
+
+constexpr size_t SINGLEFLIGHT_READERS = 16;
+
+class SingleflightTest : public StandInTest {
+public:
+  SingleflightTest() {
+    server.create("file", EntryType::FILE);
+    server.create("dir", EntryType::DIRECTORY);
+    // Every reader asks while the first listing is still in progress
+    server.delay("list", 500ms);
+  }
+
+protected:
+  std::string options() const override { return "lookup_ttl=60"; }
+
+  /* Number of calls the mount shared with another one, from mountstats */
+  static size_t coalesced() {
+    std::ifstream stats("/proc/self/mountstats");
+    std::string mount = "mounted on " + TEST_ROOT.string() + " with fstype networkfs";
+    for (std::string line; std::getline(stats, line);) {
+      if (line.find(mount) == std::string::npos) {
+        continue;
+      }
+      std::getline(stats, line);
+      size_t position = line.find("coalesced ");
+      if (position == std::string::npos) {
+        break;
+      }
+      return std::stoull(line.substr(position + std::string("coalesced ").size()));
+    }
+    throw std::runtime_error("No networkfs statistics in mountstats");
+  }
+};
+
+TEST_F(SingleflightTest, SharesConcurrentListing) {
+  std::set<std::string> expected_files{"dir", "file"};
+  std::vector<std::set<std::string>> listings(SINGLEFLIGHT_READERS);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < SINGLEFLIGHT_READERS; i++) {
+    threads.emplace_back([i, &listings]() { listings[i] = list_directory({"."}); });
+  }
+  for (auto& thread: threads) {
+    thread.join();
+  }
+
+  for (const auto& listing: listings) {
+    ASSERT_EQ(listing, expected_files);
+  }
+  ASSERT_EQ(server.calls("list"), 1);
+  ASSERT_GT(coalesced(), 0);
+}
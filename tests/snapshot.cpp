@@ -0,0 +1,69 @@
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <sys/stat.h>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+class SnapshotTest : public StandInTest {
+public:
+  SnapshotTest() {
+    server.create("file1", EntryType::FILE);
+    server.create("file2", EntryType::FILE);
+    server.create("dir", EntryType::DIRECTORY);
+  }
+
+protected:
+  std::string options() const override { return "snapshot"; }
+};
+
+TEST_F(SnapshotTest, ListsFromSnapshot) {
+  std::set<std::string> expected_files{"dir", "file1", "file2"};
+  std::set<std::string> actual_files = list_directory({"."});
+
+  ASSERT_EQ(actual_files, expected_files);
+  ASSERT_EQ(list_directory({"dir"}), std::set<std::string>{});
+  ASSERT_EQ(server.calls("list"), 0);
+}
+
+TEST_F(SnapshotTest, LooksUpFromSnapshot) {
+  ASSERT_TRUE(fs::is_regular_file({"file1"}));
+  ASSERT_TRUE(fs::is_directory({"dir"}));
+  ASSERT_FALSE(fs::exists({"missing"}));
+  ASSERT_EQ(server.calls("lookup"), 0);
+  ASSERT_EQ(server.calls("snapshot"), 1);
+}
+
+TEST_F(SnapshotTest, RefusesWrites) {
+  std::fstream fs;
+  fs.open("new", std::ios::out);
+  ASSERT_TRUE(fs.fail());
+
+  ASSERT_EQ(mkdir("newdir", 0755), -1);
+  ASSERT_EQ(errno, EROFS);
+}
+
+class LargeSnapshotTest : public SnapshotTest {
+public:
+  static constexpr size_t FILES = 5'000;
+
+  LargeSnapshotTest() {
+    for (size_t i = 0; i < FILES; i++) {
+      server.create("large-" + std::to_string(i), EntryType::FILE);
+    }
+  }
+};
+
+TEST_F(LargeSnapshotTest, StreamsLargeTreeOnce) {
+  std::set<std::string> actual_files = list_directory({"."});
+
+  ASSERT_EQ(actual_files.size(), FILES + 3);
+  ASSERT_TRUE(actual_files.contains("large-4999"));
+  ASSERT_EQ(server.calls("snapshot"), 1);
+  ASSERT_EQ(server.calls("list"), 0);
+}
@@ -0,0 +1,76 @@
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+using namespace std::chrono_literals;
+
+/* Entries are cached for an hour, so only pushed events can expire them */
+class WatchTest : public StandInTest {
+protected:
+  std::string options() const override {
+    return "watch,lookup_ttl=3600,negative_ttl=3600";
+  }
+};
+
+TEST_F(WatchTest, SeesAddedEntry) {
+  ASSERT_FALSE(fs::exists({"file"}));
+  ASSERT_TRUE(server.wait_for_watch(5s));
+
+  server.create("file", EntryType::FILE);
+
+  ASSERT_TRUE(server.wait_for_watch(5s));
+  ASSERT_TRUE(fs::exists({"file"}));
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+}
+
+TEST_F(WatchTest, SeesRemovedEntry) {
+  server.create("dir", EntryType::DIRECTORY);
+  ASSERT_TRUE(fs::is_directory({"dir"}));
+  ASSERT_TRUE(server.wait_for_watch(5s));
+
+  server.remove("dir");
+
+  ASSERT_TRUE(server.wait_for_watch(5s));
+  ASSERT_FALSE(fs::exists({"dir"}));
+}
+
+TEST_F(WatchTest, SeesReplacedEntry) {
+  server.create("entry", EntryType::FILE);
+  ASSERT_TRUE(fs::is_regular_file({"entry"}));
+  ASSERT_TRUE(server.wait_for_watch(5s));
+
+  server.remove("entry");
+  server.create("entry", EntryType::DIRECTORY);
+
+  ASSERT_TRUE(server.wait_for_watch(5s));
+  ASSERT_TRUE(fs::is_directory({"entry"}));
+}
+
+TEST_F(WatchTest, DistrustsCachesAfterLostEvents) {
+  server.create("entry", EntryType::DIRECTORY);
+  ASSERT_TRUE(fs::is_directory({"entry"}));
+  ASSERT_FALSE(fs::exists({"new"}));
+  ASSERT_TRUE(server.wait_for_watch(5s));
+
+  // Dentry in use survives shrinking the dcache
+  int fd = open("entry", O_RDONLY | O_DIRECTORY);
+  ASSERT_NE(fd, -1);
+
+  server.lose_events();
+  server.remove("entry");
+  server.create("entry", EntryType::FILE);
+  server.create("new", EntryType::FILE);
+
+  ASSERT_TRUE(server.wait_for_watch(5s));
+  ASSERT_TRUE(fs::is_regular_file({"entry"}));
+  ASSERT_TRUE(fs::is_regular_file({"new"}));
+  ASSERT_EQ(close(fd), 0);
+}
@@ -0,0 +1,127 @@
+#include <cerrno>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+class WritebackTest : public StandInTest {
+public:
+  WritebackTest() {
+    server.create("file", EntryType::FILE);
+  }
+
+protected:
+  static void append(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+      ssize_t bytes = write(fd, data.data() + written, data.size() - written);
+      ASSERT_NE(bytes, -1);
+      written += bytes;
+    }
+  }
+};
+
+TEST_F(WritebackTest, CoalescesSmallWrites) {
+  std::string expected_content;
+  int fd = open("file", O_WRONLY | O_APPEND);
+  ASSERT_NE(fd, -1);
+  for (int i = 0; i < 10; i++) {
+    std::string line = "line-" + std::to_string(i) + ".";
+    append(fd, line);
+    expected_content += line;
+  }
+  ASSERT_EQ(server.calls("write"), 0);
+  ASSERT_EQ(close(fd), 0);
+
+  ASSERT_EQ(server.calls("write"), 1);
+  ASSERT_EQ(server.content("file"), expected_content);
+}
+
+TEST_F(WritebackTest, FlushesOnFsync) {
+  int fd = open("file", O_WRONLY);
+  ASSERT_NE(fd, -1);
+
+  append(fd, "hello-world");
+  ASSERT_EQ(fsync(fd), 0);
+  ASSERT_EQ(server.content("file"), "hello-world");
+
+  append(fd, "-and-bye");
+  ASSERT_EQ(close(fd), 0);
+  ASSERT_EQ(server.content("file"), "hello-world-and-bye");
+  ASSERT_EQ(server.calls("write"), 2);
+}
+
+TEST_F(WritebackTest, KeepsUnwrittenContent) {
+  server.write("file", "0123456789");
+
+  int fd = open("file", O_WRONLY);
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(pwrite(fd, "abc", 3, 2), 3);
+  ASSERT_EQ(close(fd), 0);
+
+  ASSERT_EQ(server.content("file"), "01abc56789");
+}
+
+TEST_F(WritebackTest, Truncates) {
+  server.write("file", "0123456789");
+
+  ASSERT_EQ(truncate("file", 4), 0);
+  ASSERT_EQ(server.content("file"), "0123");
+
+  int fd = open("file", O_WRONLY | O_TRUNC);
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(server.content("file"), "");
+  ASSERT_EQ(close(fd), 0);
+}
+
+TEST_F(WritebackTest, EscapesContent) {
+  const std::string text = "hello world\nfoo&bar=#1 %20+\r\n";
+
+  int fd = open("file", O_WRONLY);
+  ASSERT_NE(fd, -1);
+  append(fd, text);
+  ASSERT_EQ(close(fd), 0);
+
+  ASSERT_EQ(server.content("file"), text);
+}
+
+TEST_F(WritebackTest, CutsLongWritesShort) {
+  const std::string text(600, 'x');
+
+  int fd = open("file", O_WRONLY);
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(write(fd, text.data(), text.size()), 512);
+  ASSERT_EQ(write(fd, text.data(), text.size()), -1);
+  ASSERT_EQ(errno, EFBIG);
+  ASSERT_EQ(close(fd), 0);
+
+  ASSERT_EQ(server.content("file"), text.substr(0, 512));
+  ASSERT_EQ(truncate("file", 600), -1);
+  ASSERT_EQ(errno, EFBIG);
+}
+
+TEST_F(WritebackTest, SeeksDirectoriesPastContentLimit) {
+  int fd = open(".", O_RDONLY | O_DIRECTORY);
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(lseek(fd, 4096, SEEK_SET), 4096);
+  ASSERT_EQ(close(fd), 0);
+}
+
+TEST_F(WritebackTest, KeepsContentIfTruncateFails) {
+  server.write("file", "0123456789");
+  int fd = open("file", O_RDONLY);
+  ASSERT_NE(fd, -1);
+
+  server.fail("write");
+  ASSERT_EQ(truncate("file", 4), -1);
+
+  ASSERT_EQ(fs::file_size("file"), 10);
+  char buffer[16] = {};
+  ASSERT_EQ(read(fd, buffer, sizeof(buffer)), 10);
+  ASSERT_STREQ(buffer, "0123456789");
+  ASSERT_EQ(close(fd), 0);
+}
@@ -0,0 +1,150 @@
+#include "transport.h"
+
+#include <linux/err.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+int networkfs_transport_init(void) { return networkfs_http_init(); }
+
+void networkfs_transport_exit(void) { networkfs_http_exit(); }
+
+struct networkfs_transport *networkfs_transport_create(
+    const struct networkfs_transport_config *config) {
+  switch (config->type) {
+    case NETWORKFS_TRANSPORT_HTTP:
+      return networkfs_http_transport_create(config);
+    case NETWORKFS_TRANSPORT_LOOPBACK:
+      return networkfs_loopback_transport_create(config);
+    default:
+      return ERR_PTR(-EINVAL);
+  }
+}
+
+void networkfs_transport_teardown(struct networkfs_transport *transport) {
+  transport->ops->teardown(transport);
+}
+
+// Methods that change nothing on the server
+const char *NETWORKFS_IDEMPOTENT_METHODS[] = {
+    "lookup",       "list",    "list_page", "getattr",
+    "list_changes", "resolve", "read",      "snapshot"};
+
+bool networkfs_method_idempotent(const char *method) {
+  if (method == NULL) {
+    return false;
+  }
+  for (int i = 0; i < ARRAY_SIZE(NETWORKFS_IDEMPOTENT_METHODS); i++) {
+    if (strcmp(NETWORKFS_IDEMPOTENT_METHODS[i], method) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int networkfs_call_vinit(struct networkfs_call *call, const char *method,
+                         char *response_buffer, size_t buffer_size,
+                         size_t arg_size, va_list args) {
+  // Call stays initialised, so that it may still be completed with the error
+  int error = WARN_ON_ONCE(arg_size > NETWORKFS_MAX_ARGS) ? -EINVAL : 0;
+
+  call->method = method;
+  call->response_buffer = response_buffer;
+  call->buffer_size = buffer_size;
+  call->arg_size = error == 0 ? arg_size : 0;
+  for (int i = 0; i < 2 * call->arg_size; i++) {
+    call->args[i] = va_arg(args, const char *);
+  }
+  call->conditional = false;
+  call->if_none_match = NULL;
+  call->etag[0] = '\0';
+  call->idempotent = networkfs_method_idempotent(method);
+  call->consume = NULL;
+  call->consume_data = NULL;
+  call->result = 0;
+  init_completion(&call->done);
+  return error;
+}
+
+int networkfs_call_init(struct networkfs_call *call, const char *method,
+                        char *response_buffer, size_t buffer_size,
+                        size_t arg_size, ...) {
+  va_list args;
+  va_start(args, arg_size);
+  int error = networkfs_call_vinit(call, method, response_buffer, buffer_size,
+                                   arg_size, args);
+  va_end(args);
+  return error;
+}
+
+int64_t networkfs_transport_call(struct networkfs_transport *transport,
+                                 const char *method, char *response_buffer,
+                                 size_t buffer_size, size_t arg_size, ...) {
+  struct networkfs_call call;
+  va_list args;
+
+  va_start(args, arg_size);
+  int error = networkfs_call_vinit(&call, method, response_buffer,
+                                   buffer_size, arg_size, args);
+  va_end(args);
+  if (error != 0) {
+    return error;
+  }
+
+  return networkfs_call_run(transport, &call);
+}
+
+int64_t networkfs_call_run(struct networkfs_transport *transport,
+                           struct networkfs_call *call) {
+  atomic_inc(&transport->calls);
+  int64_t ret = transport->ops->call(transport, call);
+  atomic_dec(&transport->calls);
+  return ret;
+}
+
+int64_t networkfs_transport_watch(struct networkfs_transport *transport,
+                                  struct networkfs_call *call) {
+  if (transport->ops->watch == NULL) {
+    return -EOPNOTSUPP;
+  }
+  return transport->ops->watch(transport, call);
+}
+
+void networkfs_transport_interrupt(struct networkfs_transport *transport) {
+  if (transport->ops->interrupt != NULL) {
+    transport->ops->interrupt(transport);
+  }
+}
+
+int64_t networkfs_call_wait(struct networkfs_call *call) {
+  wait_for_completion(&call->done);
+  return call->result;
+}
+
+void networkfs_call_complete(struct networkfs_call *call, int64_t result) {
+  call->result = result;
+  complete(&call->done);
+}
+
+const char *networkfs_call_arg(const struct networkfs_call *call,
+                               const char *key) {
+  for (int i = 0; i < call->arg_size; i++) {
+    if (strcmp(call->args[2 * i], key) == 0) {
+      return call->args[2 * i + 1];
+    }
+  }
+  return NULL;
+}
+
+void networkfs_call_async_work(struct work_struct *work) {
+  struct networkfs_call *call = container_of(work, struct networkfs_call, work);
+  struct networkfs_transport *transport = call->transport;
+  networkfs_call_complete(call, transport->ops->call(transport, call));
+}
+
+int networkfs_call_async_sync(struct networkfs_transport *transport,
+                              struct networkfs_call *call) {
+  call->transport = transport;
+  INIT_WORK(&call->work, networkfs_call_async_work);
+  queue_work(system_unbound_wq, &call->work);
+  return 0;
+}
@@ -0,0 +1,237 @@
+#ifndef NETWORKFS_TRANSPORT
+#define NETWORKFS_TRANSPORT
+
+#include <linux/atomic.h>
+#include <linux/completion.h>
+#include <linux/in.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+// Enough for any method of networkfs API
+#define NETWORKFS_MAX_ARGS 4
+
+// Longest entity tag kept by a call, including the quotes and terminator
+#define NETWORKFS_ETAG_SIZE 64
+
+struct networkfs_transport;
+
+enum networkfs_transport_type {
+  NETWORKFS_TRANSPORT_HTTP,
+  NETWORKFS_TRANSPORT_LOOPBACK,
+};
+
+/**
+ * struct networkfs_call - a single call to networkfs API.
+ * @method:          API method name, e.g. "list" for fs.list.
+ * @response_buffer: Pointer to memory space for writing the response.
+ *                   There should be available at least @buffer_size bytes.
+ * @response_size:   Size of the response sent by the server. Set even when
+ *                   it does not fit into @response_buffer, so the caller can
+ *                   retry with a larger one.
+ * @arg_size:        Number of arguments provided.
+ * @args:            Exactly twice of @arg_size string arguments in format
+ *                   key1, value1, key2, value2, ...
+ * @conditional:     Call takes part in revalidation: @etag is reported and
+ *                   @if_none_match is honoured. Transports unable to do so
+ *                   fail such calls with -EOPNOTSUPP.
+ * @if_none_match:   Entity tag of the response cached by the caller, or NULL.
+ *                   If it still matches, the call returns
+ *                   NETWORKFS_ENOTMODIFIED and leaves @response_buffer
+ *                   unaltered.
+ * @etag:            Entity tag of the response, empty if there is none.
+ * @idempotent:      Call changes nothing on the server, so its request may
+ *                   be sent again when the connection breaks before the
+ *                   response arrives. Set from @method by networkfs_call_init.
+ * @consume:         If set, the response is passed to it piece by piece as
+ *                   it arrives instead of being written into
+ *                   @response_buffer, which is then unused. Stops the call
+ *                   by returning negated errno, which the call returns.
+ *                   Pieces of an error response are not passed.
+ * @consume_data:    Passed to @consume.
+ * @result:          Outcome of the call, see networkfs_transport_call().
+ * @done:            Completed when @result is set by asynchronous call.
+ * @work:            Used by transports to run asynchronous calls.
+ * @transport:       Transport running asynchronous call.
+ *
+ * Arguments and response buffer must stay valid until the call completes.
+ */
+struct networkfs_call {
+  const char *method;
+  char *response_buffer;
+  size_t buffer_size;
+  size_t response_size;
+  size_t arg_size;
+  const char *args[2 * NETWORKFS_MAX_ARGS];
+  bool conditional;
+  const char *if_none_match;
+  char etag[NETWORKFS_ETAG_SIZE];
+  bool idempotent;
+  int (*consume)(void *data, const char *piece, size_t size);
+  void *consume_data;
+
+  int64_t result;
+  struct completion done;
+  struct work_struct work;
+  struct networkfs_transport *transport;
+};
+
+/**
+ * struct networkfs_transport_ops - implementation of networkfs API.
+ * @call:       Make a call and wait for the result, which is returned.
+ * @call_async: Start a call. Its result is reported through @call->done;
+ *              returns zero or negated errno if the call was not started.
+ * @watch:      Make a long-poll call, which the server may hold until it has
+ *              something to report, without delaying other calls. NULL if
+ *              the backend cannot watch.
+ * @interrupt:  Make @watch calls, in progress and future ones, return -EINTR.
+ * @teardown:   Release transport. No calls may be in progress.
+ */
+struct networkfs_transport_ops {
+  int64_t (*call)(struct networkfs_transport *transport,
+                  struct networkfs_call *call);
+  int (*call_async)(struct networkfs_transport *transport,
+                    struct networkfs_call *call);
+  int64_t (*watch)(struct networkfs_transport *transport,
+                   struct networkfs_call *call);
+  void (*interrupt)(struct networkfs_transport *transport);
+  void (*teardown)(struct networkfs_transport *transport);
+};
+
+/**
+ * struct networkfs_transport - backend of a mount.
+ * @ops:   Implementation of the API.
+ * @calls: Synchronous calls in progress, not counting long-poll ones.
+ */
+struct networkfs_transport {
+  const struct networkfs_transport_ops *ops;
+  atomic_t calls;
+};
+
+/**
+ * struct networkfs_transport_config - per-mount transport choice.
+ * @type:  Backend implementing the API.
+ * @token: Unique filesystem token.
+ * @addr:  API server address, used by network backends.
+ */
+struct networkfs_transport_config {
+  enum networkfs_transport_type type;
+  const char *token;
+  struct sockaddr_in addr;
+};
+
+/**
+ * networkfs_transport_init - set up state shared by all mounts.
+ *
+ * Return: 0 on success, otherwise negated errno.
+ */
+int networkfs_transport_init(void);
+
+void networkfs_transport_exit(void);
+
+/**
+ * networkfs_transport_create - set up backend chosen for the mount.
+ *
+ * Return: new transport or ERR_PTR.
+ */
+struct networkfs_transport *networkfs_transport_create(
+    const struct networkfs_transport_config *config);
+
+void networkfs_transport_teardown(struct networkfs_transport *transport);
+
+/**
+ * networkfs_transport_call - make a call to networkfs API.
+ * @transport:       Transport of the mount.
+ * @method:          API method name, e.g. "list" for fs.list.
+ * @response_buffer: Pointer to memory space for writing the response.
+ *                   There should be available at least @buffer_size bytes.
+ * @arg_size:        Number of arguments provided.
+ * @...:             Exactly twice of @arg_size string arguments in format
+ *                   key1, value1, key2, value2, ...
+ *
+ * Return:
+ * * If the call succeeds, returns `result->status`.
+ *   `result->response` is written into @response_buffer.
+ * * If the response does not fit into @response_buffer, returns -ENOSPC.
+ * * Otherwise, returns negated errno, either defined in `errno-base.h`
+ *   or in `http.h`, and @response_buffer stays unaltered.
+ */
+int64_t networkfs_transport_call(struct networkfs_transport *transport,
+                                 const char *method, char *response_buffer,
+                                 size_t buffer_size, size_t arg_size, ...);
+
+/**
+ * networkfs_call_init - prepare call from variadic arguments.
+ *
+ * Arguments are the same as for networkfs_transport_call().
+ *
+ * Return: 0, or -EINVAL if @arg_size exceeds NETWORKFS_MAX_ARGS. The call is
+ * then prepared without arguments and must not be made.
+ */
+int networkfs_call_init(struct networkfs_call *call, const char *method,
+                        char *response_buffer, size_t buffer_size,
+                        size_t arg_size, ...);
+
+int networkfs_call_vinit(struct networkfs_call *call, const char *method,
+                         char *response_buffer, size_t buffer_size,
+                         size_t arg_size, va_list args);
+
+/**
+ * networkfs_method_idempotent - whether the API method only reads.
+ */
+bool networkfs_method_idempotent(const char *method);
+
+/**
+ * networkfs_call_run - make a prepared call and wait for the result.
+ *
+ * Return: the same as networkfs_transport_call().
+ */
+int64_t networkfs_call_run(struct networkfs_transport *transport,
+                           struct networkfs_call *call);
+
+/**
+ * networkfs_transport_watch - make a prepared long-poll call.
+ *
+ * Return: the same as networkfs_transport_call(), -EOPNOTSUPP if the
+ * transport cannot watch, or -EINTR after networkfs_transport_interrupt().
+ */
+int64_t networkfs_transport_watch(struct networkfs_transport *transport,
+                                  struct networkfs_call *call);
+
+/**
+ * networkfs_transport_interrupt - stop long-poll calls of the transport.
+ */
+void networkfs_transport_interrupt(struct networkfs_transport *transport);
+
+int64_t networkfs_call_wait(struct networkfs_call *call);
+
+/**
+ * networkfs_call_complete - report result of asynchronous call.
+ */
+void networkfs_call_complete(struct networkfs_call *call, int64_t result);
+
+/**
+ * networkfs_call_arg - find argument value by its key.
+ *
+ * Return: value or NULL if there is no such argument.
+ */
+const char *networkfs_call_arg(const struct networkfs_call *call,
+                               const char *key);
+
+/**
+ * networkfs_call_async_sync - implement call_async by running synchronous
+ * call on a workqueue, for transports without native asynchronous calls.
+ */
+int networkfs_call_async_sync(struct networkfs_transport *transport,
+                              struct networkfs_call *call);
+
+int networkfs_http_init(void);
+
+void networkfs_http_exit(void);
+
+struct networkfs_transport *networkfs_http_transport_create(
+    const struct networkfs_transport_config *config);
+
+struct networkfs_transport *networkfs_loopback_transport_create(
+    const struct networkfs_transport_config *config);
+
+#endif
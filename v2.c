@@ -0,0 +1,404 @@
+#include "v2.h"
+
+#include <linux/kthread.h>
+#include <linux/net.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "http.h"
+#include "transport.h"
+
+const char *V2_UPGRADE_REQUEST_LINE = "GET /teaching/os/networkfs/v2/";
+const char *V2_UPGRADE_REQUEST_HEADERS =
+    "/connect HTTP/1.1\r\nHost:nerc.itmo.ru\r\nConnection: Upgrade\r\n"
+    "Upgrade: " NETWORKFS_V2_UPGRADE "\r\n\r\n";
+const char *V2_UPGRADE_STATUS = " 101 ";
+
+const char *V2_METHODS[NETWORKFS_V2_OPCODE_MAX] = {
+    [NETWORKFS_V2_LOOKUP] = "lookup", [NETWORKFS_V2_LIST] = "list",
+    [NETWORKFS_V2_CREATE] = "create", [NETWORKFS_V2_UNLINK] = "unlink",
+    [NETWORKFS_V2_RMDIR] = "rmdir",   [NETWORKFS_V2_READ] = "read",
+    [NETWORKFS_V2_WRITE] = "write",   [NETWORKFS_V2_LINK] = "link",
+    [NETWORKFS_V2_LIST_PAGE] = "list_page",
+    [NETWORKFS_V2_GETATTR] = "getattr",
+    [NETWORKFS_V2_LIST_CHANGES] = "list_changes"};
+
+int networkfs_v2_opcode(const char *method) {
+  for (int i = 1; i < NETWORKFS_V2_OPCODE_MAX; i++) {
+    if (strcmp(V2_METHODS[i], method) == 0) {
+      return i;
+    }
+  }
+  return -EOPNOTSUPP;
+}
+
+// Reads exactly @size bytes from the stream
+int networkfs_v2_receive(struct socket *sock, char *buffer, size_t size) {
+  struct msghdr hdr;
+  struct kvec vec;
+
+  while (size > 0) {
+    memset(&hdr, 0, sizeof(struct msghdr));
+    vec.iov_base = buffer;
+    vec.iov_len = size;
+    int ret = kernel_recvmsg(sock, &hdr, &vec, 1, size, MSG_WAITALL);
+    if (ret == 0) {
+      return -ECONNRESET;
+    } else if (ret < 0) {
+      return ret;
+    }
+    buffer += ret;
+    size -= ret;
+  }
+
+  return 0;
+}
+
+// Skips @size bytes of the stream, e.g. a payload nobody waits for
+int networkfs_v2_discard(struct socket *sock, size_t size) {
+  char scratch[64];
+
+  while (size > 0) {
+    size_t chunk = min(size, sizeof(scratch));
+    int error = networkfs_v2_receive(sock, scratch, chunk);
+    if (error != 0) {
+      return error;
+    }
+    size -= chunk;
+  }
+
+  return 0;
+}
+
+// Fails every pending call and makes further calls use HTTP API
+void networkfs_v2_fail(struct networkfs_v2_session *session, int error) {
+  struct networkfs_call *call;
+  unsigned long id;
+
+  WRITE_ONCE(session->error, error);
+  xa_for_each(&session->pending, id, call) {
+    if (xa_erase(&session->pending, id) == call) {
+      networkfs_call_complete(call, -ESOCKNOMSGRECV);
+    }
+  }
+}
+
+// Waits until the next response starts arriving. Silence of an idle session
+// is fine, the stream is only given up when calls stayed unanswered for a
+// whole timeout: they were pending at two timeouts in a row with nothing
+// received in between.
+int networkfs_v2_wait_response(struct networkfs_v2_session *session) {
+  bool stalled = false;
+  struct msghdr hdr;
+  struct kvec vec;
+  char byte;
+
+  while (true) {
+    memset(&hdr, 0, sizeof(struct msghdr));
+    vec.iov_base = &byte;
+    vec.iov_len = 1;
+    int ret = kernel_recvmsg(session->sock, &hdr, &vec, 1, 1, MSG_PEEK);
+    if (ret > 0) {
+      return 0;
+    } else if (ret == 0) {
+      return -ECONNRESET;
+    } else if (ret != -EAGAIN) {
+      return ret;
+    }
+
+    bool pending = !xa_empty(&session->pending);
+    if (pending && stalled) {
+      return ret;
+    }
+    stalled = pending;
+  }
+}
+
+int networkfs_v2_receiver(void *data) {
+  struct networkfs_v2_session *session = data;
+  struct networkfs_v2_response_header header;
+  int error;
+
+  while (true) {
+    error = networkfs_v2_wait_response(session);
+    if (error != 0) {
+      break;
+    }
+    error = networkfs_v2_receive(session->sock, (char *)&header,
+                                 sizeof(header));
+    if (error != 0) {
+      break;
+    }
+
+    size_t length = le32_to_cpu(header.length);
+    if (length < sizeof(header) - sizeof(header.length)) {
+      error = -EPROTMALFORMED;
+      break;
+    }
+    size_t payload_size = length - (sizeof(header) - sizeof(header.length));
+
+    struct networkfs_call *call =
+        xa_erase(&session->pending, le32_to_cpu(header.request_id));
+    if (call == NULL) {
+      error = networkfs_v2_discard(session->sock, payload_size);
+      if (error != 0) {
+        break;
+      }
+      continue;
+    }
+
+    call->response_size = payload_size;
+    size_t copy_size = min(payload_size, call->buffer_size);
+    error =
+        networkfs_v2_receive(session->sock, call->response_buffer, copy_size);
+    if (error == 0) {
+      error = networkfs_v2_discard(session->sock, payload_size - copy_size);
+    }
+    if (error != 0) {
+      networkfs_call_complete(call, -ESOCKNOMSGRECV);
+      break;
+    }
+
+    networkfs_call_complete(call, payload_size > call->buffer_size
+                                      ? -ENOSPC
+                                      : (int64_t)le64_to_cpu(header.status));
+  }
+
+  networkfs_v2_fail(session, error);
+
+  // Stay around until networkfs_v2_close() stops us
+  while (!kthread_should_stop()) {
+    set_current_state(TASK_INTERRUPTIBLE);
+    if (!kthread_should_stop()) {
+      schedule();
+    }
+    __set_current_state(TASK_RUNNING);
+  }
+
+  return 0;
+}
+
+// Sends HTTP Upgrade request and checks that the server switched protocols
+int networkfs_v2_upgrade(struct socket *sock, const char *token) {
+  struct msghdr msg;
+  struct kvec vec[3] = {
+      {.iov_base = (char *)V2_UPGRADE_REQUEST_LINE,
+       .iov_len = strlen(V2_UPGRADE_REQUEST_LINE)},
+      {.iov_base = (char *)token, .iov_len = strlen(token)},
+      {.iov_base = (char *)V2_UPGRADE_REQUEST_HEADERS,
+       .iov_len = strlen(V2_UPGRADE_REQUEST_HEADERS)}};
+  size_t length = vec[0].iov_len + vec[1].iov_len + vec[2].iov_len;
+
+  memset(&msg, 0, sizeof(struct msghdr));
+  if (kernel_sendmsg(sock, &msg, vec, 3, length) < 0) {
+    return -ESOCKNOMSGSEND;
+  }
+
+  // Read the response byte by byte, so that nothing after the headers is
+  // consumed from the stream
+  char response[256];
+  size_t read = 0;
+  while (read < 4 || strncmp(response + read - 4, "\r\n\r\n", 4) != 0) {
+    if (read == sizeof(response) - 1) {
+      return -EHTTPMALFORMED;
+    }
+    int error = networkfs_v2_receive(sock, response + read, 1);
+    if (error != 0) {
+      return -ESOCKNOMSGRECV;
+    }
+    ++read;
+  }
+  response[read] = '\0';
+
+  char *status = strchr(response, ' ');
+  if (status == NULL ||
+      strncmp(status, V2_UPGRADE_STATUS, strlen(V2_UPGRADE_STATUS)) != 0) {
+    return -EHTTPBADCODE;
+  }
+
+  return 0;
+}
+
+struct networkfs_v2_session *networkfs_v2_connect(
+    const struct sockaddr_in *addr, const char *token) {
+  struct networkfs_v2_session *session;
+  int error;
+
+  session = kzalloc(sizeof(struct networkfs_v2_session), GFP_KERNEL);
+  if (session == NULL) {
+    return ERR_PTR(-ENOMEM);
+  }
+
+  error = networkfs_socket_connect(addr, &session->sock);
+  if (error != 0) {
+    goto free;
+  }
+
+  error = networkfs_v2_upgrade(session->sock, token);
+  if (error != 0) {
+    goto release;
+  }
+
+  mutex_init(&session->send_lock);
+  xa_init_flags(&session->pending, XA_FLAGS_ALLOC);
+
+  session->receiver =
+      kthread_run(networkfs_v2_receiver, session, "networkfs-v2");
+  if (IS_ERR(session->receiver)) {
+    error = PTR_ERR(session->receiver);
+    goto release;
+  }
+
+  return session;
+
+release:
+  kernel_sock_shutdown(session->sock, SHUT_RDWR);
+  sock_release(session->sock);
+free:
+  kfree(session);
+  return ERR_PTR(error);
+}
+
+void networkfs_v2_close(struct networkfs_v2_session *session) {
+  // Unblocks the receiver, which then fails pending requests
+  kernel_sock_shutdown(session->sock, SHUT_RDWR);
+  kthread_stop(session->receiver);
+  sock_release(session->sock);
+  xa_destroy(&session->pending);
+  kfree(session);
+}
+
+// Lengths of an argument of a request frame, as they are sent
+struct networkfs_v2_arg_lengths {
+  u8 key;
+  __le16 value;
+} __packed;
+
+// Pieces of a request frame: the header, and the key length, key, value
+// length and value of every argument
+#define V2_REQUEST_MAX_VECS (1 + 4 * NETWORKFS_MAX_ARGS)
+
+// Describes request frame as pieces pointing to @header, @lengths and the
+// arguments of @call, so nothing is copied. Returns number of pieces.
+size_t networkfs_v2_fill_request(struct kvec *vec, size_t *size,
+                                 struct networkfs_v2_request_header *header,
+                                 struct networkfs_v2_arg_lengths *lengths,
+                                 int opcode, u32 request_id,
+                                 const struct networkfs_call *call) {
+  size_t count = 0;
+  size_t length = sizeof(struct networkfs_v2_request_header);
+
+  fill_vec(&vec[count++], (char *)header, sizeof(*header));
+  for (int i = 0; i < call->arg_size; i++) {
+    const char *key = call->args[2 * i];
+    const char *value = call->args[2 * i + 1];
+
+    lengths[i].key = strlen(key);
+    lengths[i].value = cpu_to_le16(strlen(value));
+    fill_vec(&vec[count++], (char *)&lengths[i].key, sizeof(lengths[i].key));
+    fill_vec(&vec[count++], key, strlen(key));
+    fill_vec(&vec[count++], (char *)&lengths[i].value,
+             sizeof(lengths[i].value));
+    fill_vec(&vec[count++], value, strlen(value));
+    length += sizeof(u8) + strlen(key) + sizeof(__le16) + strlen(value);
+  }
+
+  header->length = cpu_to_le32(length - sizeof(header->length));
+  header->opcode = cpu_to_le16(opcode);
+  header->arg_count = cpu_to_le16(call->arg_size);
+  header->request_id = cpu_to_le32(request_id);
+
+  *size = length;
+  return count;
+}
+
+// Takes back @call that nobody is going to wait for, e.g. one that never
+// reached the server. If the receiver has taken it meanwhile, waits until it
+// is done with the call, so the caller may reuse it and its buffer.
+void networkfs_v2_withdraw(struct networkfs_v2_session *session, u32 id,
+                           struct networkfs_call *call) {
+  if (xa_erase(&session->pending, id) != call) {
+    wait_for_completion(&call->done);
+  }
+}
+
+// Sends @call, which is then pending under @id
+int networkfs_v2_start(struct networkfs_v2_session *session,
+                       struct networkfs_call *call, u32 *id) {
+  int error;
+
+  int opcode = networkfs_v2_opcode(call->method);
+  if (opcode < 0) {
+    return opcode;
+  }
+  // Frames carry no entity tags and are received whole, such calls go over
+  // HTTP
+  if (call->conditional || call->consume != NULL) {
+    return -EOPNOTSUPP;
+  }
+  if (READ_ONCE(session->error) != 0) {
+    return -ENOTCONN;
+  }
+
+  reinit_completion(&call->done);
+  error = xa_alloc_cyclic(&session->pending, id, call, xa_limit_32b,
+                          &session->next_id, GFP_KERNEL);
+  if (error < 0) {
+    return error;
+  }
+  // Positive value only tells that identifiers wrapped
+  error = 0;
+  // Receiver may have failed pending calls before this one was added. It is
+  // sent over HTTP then, whoever removes it.
+  if (READ_ONCE(session->error) != 0) {
+    networkfs_v2_withdraw(session, *id, call);
+    return -ENOTCONN;
+  }
+
+  struct networkfs_v2_request_header header;
+  struct networkfs_v2_arg_lengths lengths[NETWORKFS_MAX_ARGS];
+  struct kvec vec[V2_REQUEST_MAX_VECS];
+  size_t frame_size;
+  size_t vec_count = networkfs_v2_fill_request(vec, &frame_size, &header,
+                                               lengths, opcode, *id, call);
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(struct msghdr));
+
+  mutex_lock(&session->send_lock);
+  if (kernel_sendmsg(session->sock, &msg, vec, vec_count, frame_size) !=
+      frame_size) {
+    // Partially sent frame breaks the stream for everyone
+    kernel_sock_shutdown(session->sock, SHUT_RDWR);
+    error = -ENOTCONN;
+  }
+  mutex_unlock(&session->send_lock);
+
+  // Server could not have answered an incomplete frame, so the call goes
+  // over HTTP instead
+  if (error != 0) {
+    networkfs_v2_withdraw(session, *id, call);
+  }
+  return error;
+}
+
+int networkfs_v2_call_async(struct networkfs_v2_session *session,
+                            struct networkfs_call *call) {
+  u32 id;
+  return networkfs_v2_start(session, call, &id);
+}
+
+int64_t networkfs_v2_call(struct networkfs_v2_session *session,
+                          struct networkfs_call *call) {
+  u32 id;
+  int error = networkfs_v2_start(session, call, &id);
+  if (error != 0) {
+    return error;
+  }
+
+  if (wait_for_completion_killable(&call->done) != 0) {
+    // A late response is discarded by the receiver
+    networkfs_v2_withdraw(session, id, call);
+    return -EINTR;
+  }
+  return call->result;
+}
@@ -0,0 +1,101 @@
+#ifndef NETWORKFS_V2
+#define NETWORKFS_V2
+
+#include <linux/in.h>
+#include <linux/mutex.h>
+#include <linux/types.h>
+#include <linux/xarray.h>
+
+// Binary protocol is negotiated with an HTTP Upgrade to this token
+#define NETWORKFS_V2_UPGRADE "networkfs-v2"
+
+enum networkfs_v2_opcode {
+  NETWORKFS_V2_LOOKUP = 1,
+  NETWORKFS_V2_LIST,
+  NETWORKFS_V2_CREATE,
+  NETWORKFS_V2_UNLINK,
+  NETWORKFS_V2_RMDIR,
+  NETWORKFS_V2_READ,
+  NETWORKFS_V2_WRITE,
+  NETWORKFS_V2_LINK,
+  NETWORKFS_V2_LIST_PAGE,
+  NETWORKFS_V2_GETATTR,
+  NETWORKFS_V2_LIST_CHANGES,
+  NETWORKFS_V2_OPCODE_MAX
+};
+
+/*
+ * Every frame starts with its length, not counting the length field itself.
+ * Request header is followed by @arg_count arguments, each encoded as
+ * u8 key length, key, le16 value length, value. Response header is followed
+ * by the payload, laid out as the structs in models.h.
+ */
+struct networkfs_v2_request_header {
+  __le32 length;
+  __le16 opcode;
+  __le16 arg_count;
+  __le32 request_id;
+} __packed;
+
+struct networkfs_v2_response_header {
+  __le32 length;
+  __le32 request_id;
+  __le64 status;
+} __packed;
+
+/**
+ * struct networkfs_v2_session - binary protocol stream of a mount.
+ * @sock:      Upgraded connection.
+ * @send_lock: Serializes frames written to @sock.
+ * @pending:   Calls waiting for a response, indexed by request id.
+ * @next_id:   Hint for the next request id.
+ * @error:     Zero while the stream is usable.
+ * @receiver:  Thread reading responses and completing @pending calls,
+ *             in whatever order the server answers them.
+ */
+struct networkfs_v2_session {
+  struct socket *sock;
+  struct mutex send_lock;
+  struct xarray pending;
+  u32 next_id;
+  int error;
+  struct task_struct *receiver;
+};
+
+struct networkfs_call;
+
+/**
+ * networkfs_v2_connect - negotiate binary protocol with the server.
+ * @addr:  API server address.
+ * @token: Unique filesystem token.
+ *
+ * Return: new session, or ERR_PTR if the server does not support the
+ * binary protocol and HTTP API should be used instead.
+ */
+struct networkfs_v2_session *networkfs_v2_connect(
+    const struct sockaddr_in *addr, const char *token);
+
+void networkfs_v2_close(struct networkfs_v2_session *session);
+
+/**
+ * networkfs_v2_call_async - start a call over binary protocol.
+ *
+ * The result is reported through @call->done once the response arrives.
+ *
+ * Return: zero, -EOPNOTSUPP if the method has no opcode, or -ENOTCONN if the
+ * stream is broken. In the latter two cases HTTP API should be used instead.
+ */
+int networkfs_v2_call_async(struct networkfs_v2_session *session,
+                            struct networkfs_call *call);
+
+/**
+ * networkfs_v2_call - make a call over binary protocol and wait for it.
+ *
+ * Return: the same as networkfs_transport_call(), errors of
+ * networkfs_v2_call_async(), or -EINTR if the caller is killed while
+ * waiting.
+ */
+int64_t networkfs_v2_call(struct networkfs_v2_session *session,
+                          struct networkfs_call *call);
+
+#endif